@@ -0,0 +1,193 @@
+//
+// Name filtered view of an image model.
+//
+// Contents:
+//
+//   FilteredModel::filter()      - Show the items matching a query.
+//   FilteredModel::refresh()     - Match the source's items again.
+//   FilteredModel::match()       - Find the items matching a query.
+//   FilteredModel::plain()       - Is a query plain text?
+//   FilteredModel::indexOf()     - Get our index for a source index.
+//   FilteredModel::selectRange() - Select a range of matches.
+//   FilteredModel::dirty()       - Get the source's dirty items as ours.
+//
+
+#include <FL/filename.H>
+#include <algorithm> // lower_bound
+#include <string.h>
+
+#include "FilteredModel.h"
+
+
+FilteredModel::FilteredModel(ImageModel *source)
+{
+  source_ = source;
+  all_    = true;
+}
+
+
+//
+// 'FilteredModel::filter()' - Show the items matching a query.
+//
+
+bool					// O - false if the matches are unchanged
+FilteredModel::filter(const char *query)	// I - Pattern or text, "" for all
+{
+  if (!query)
+    query = "";
+
+  if (query_ == query)
+    return false;
+
+  if (!*query)
+  {
+    bool changed = !all_;
+
+    query_.clear();
+    all_ = true;
+    map_.clear();
+    return changed;
+  }
+
+  // Plain text which extends the last query can only match fewer items
+  bool narrow = !all_ && plain(query) && plain(query_.c_str()) &&
+                strstr(query, query_.c_str()) != NULL;
+  size_t before = all_ ? (size_t)source_->count() : map_.size();
+  std::vector<int> old;
+
+  if (!narrow && !all_)
+    old.swap(map_);
+
+  match(query, narrow);
+
+  query_ = query;
+  all_   = false;
+
+  if (narrow)
+    return map_.size() != before;
+
+  return old.empty() ? map_.size() != before : old != map_;
+}
+
+
+//
+// 'FilteredModel::refresh()' - Match the source's items again.
+//
+// The source is brought up to date first, in case it is a filter too.
+//
+
+void
+FilteredModel::refresh()
+{
+  source_->refresh();
+
+  if (!all_)
+    match(query_.c_str(), false);
+}
+
+
+//
+// 'FilteredModel::match()' - Find the items matching a query.
+//
+
+void
+FilteredModel::match(
+    const char *query,			// I - Pattern or text
+    bool       narrow)			// I - Only look at the current matches
+{
+  std::string pattern;			// fl_filename_match() pattern
+
+
+  if (plain(query))
+    pattern = std::string("*") + query + "*";
+  else
+    pattern = query;
+
+  if (narrow)
+  {
+    // Few enough to do in place
+    size_t kept = 0;
+
+    for (int src : map_)
+      if (fl_filename_match(source_->name(src), pattern.c_str()))
+        map_[kept ++] = src;
+
+    map_.resize(kept);
+    return;
+  }
+
+  int n = source_->count();
+  std::vector<unsigned char> hit(n);
+
+#pragma omp parallel for schedule(static) if (n > 10000)
+  for (int i = 0; i < n; i ++)
+    hit[i] = fl_filename_match(source_->name(i), pattern.c_str()) != 0;
+
+  map_.clear();
+  for (int i = 0; i < n; i ++)
+    if (hit[i])
+      map_.push_back(i);
+}
+
+
+//
+// 'FilteredModel::plain()' - Is a query plain text?
+//
+
+bool					// O - true if it has no wildcards
+FilteredModel::plain(const char *query)	// I - Query
+{
+  return strpbrk(query, "*?[{\\") == NULL;
+}
+
+
+//
+// 'FilteredModel::indexOf()' - Get our index for a source index.
+//
+
+int					// O - Index, or -1 if filtered out
+FilteredModel::indexOf(int src) const	// I - Source index
+{
+  if (all_)
+    return src;
+
+  auto it = std::lower_bound(map_.begin(), map_.end(), src);
+
+  return it != map_.end() && *it == src ? (int)(it - map_.begin()) : -1;
+}
+
+
+//
+// 'FilteredModel::selectRange()' - Select a range of matches.
+//
+// Only the matches: the source items in between stay as they are.
+//
+
+void
+FilteredModel::selectRange(int from,	// I - First match
+                           int to)	// I - Last match
+{
+  for (int i = std::min(from, to); i <= std::max(from, to); i ++)
+    source_->forceSelect(sourceIndex(i));
+}
+
+
+//
+// 'FilteredModel::dirty()' - Get the source's dirty items as ours.
+//
+
+std::vector<int> &			// O - Items to repaint
+FilteredModel::dirty()
+{
+  dirty_.clear();
+
+  for (int src : source_->dirty())
+  {
+    int i = indexOf(src);
+
+    if (i >= 0)
+      dirty_.push_back(i);
+  }
+
+  return dirty_;
+}
@@ -0,0 +1,74 @@
+#ifndef _FILTEREDMODEL_H_
+#define _FILTEREDMODEL_H_
+
+#include <string>
+#include <vector>
+
+#include "ImageModel.h"
+
+// The items of another model whose names match a query, in the same
+// order. A query with wildcards is an fl_filename_match() pattern; plain
+// text matches anywhere in the name.
+//
+// Extending a plain query [typing another character] only searches the
+// previous matches, so narrowing stays fast on very large models. Other
+// queries scan the whole source, on all cores: the source's name() must
+// be safe to call from several threads at once [ItemList's is].
+// Selection and thumbnails are the source model's.
+//
+// The source may not change behind the filter's back: call refresh()
+// after adding, removing or moving its items, then
+// Fl_Image_BrowserV::modelChanged(). The widget does so itself for the
+// changes it makes to its own ItemList.
+//
+class FilteredModel : public ImageModel
+{
+  ImageModel       *source_;
+  std::string      query_;
+  bool             all_;      // empty query: everything, map_ unused
+  std::vector<int> map_;      // source index of each match, ascending
+  std::vector<int> dirty_;    // source's dirty list, in our indices
+
+  static bool plain(const char *query);
+  void        match(const char *query, bool narrow);
+
+public:
+  FilteredModel(ImageModel *source);
+
+  // Show the items matching query. false if the result is unchanged.
+  bool        filter(const char *query);
+  const char *query() const { return query_.c_str(); }
+  void        refresh();
+
+  ImageModel *source() const { return source_; }
+  int         sourceIndex(int i) const { return all_ ? i : map_[i]; }
+  int         indexOf(int src) const;
+
+  // ImageModel
+  int         count() const { return all_ ? source_->count() : (int)map_.size(); }
+  const char *name(int i) { return source_->name(sourceIndex(i)); }
+  unsigned    id(int i) { return source_->id(sourceIndex(i)); }
+  bool        dimensions(int i, int &w, int &h) { return source_->dimensions(sourceIndex(i), w, h); }
+  Fl_Image   *thumbnail(int i) { return source_->thumbnail(sourceIndex(i)); }
+  const void *thumbnailKey(int i) { return source_->thumbnailKey(sourceIndex(i)); }
+  void        keepThumbnails(bool keep) { source_->keepThumbnails(keep); }
+  size_t      keepBytes() { return source_->keepBytes(); }
+  bool        fetched(int i) { return source_->fetched(sourceIndex(i)); }
+  void        fetch(int i) { source_->fetch(sourceIndex(i)); }
+  void        fetchNow(int i) { source_->fetchNow(sourceIndex(i)); }
+  void        cancelFetch() { source_->cancelFetch(); }
+  void        prefetch(int i, int direction) { source_->prefetch(sourceIndex(i), direction); }
+
+  bool        isSelected(int i) { return source_->isSelected(sourceIndex(i)); }
+  int         changed(int i) { return source_->changed(sourceIndex(i)); }
+  void        select(int i) { source_->select(sourceIndex(i)); }
+  void        forceSelect(int i) { source_->forceSelect(sourceIndex(i)); }
+  void        toggleSelect(int i) { source_->toggleSelect(sourceIndex(i)); }
+  void        selectRange(int from, int to);
+  void        clearSelect() { source_->clearSelect(); }
+
+  std::vector<int> &dirty();
+  void        clearDirty() { source_->clearDirty(); dirty_.clear(); }
+};
+
+#endif // _FILTEREDMODEL_H_
@@ -20,6 +20,9 @@
 //   Fl_Image_BrowserV::draw()                 - Draw the image display widget.
 //   Fl_Image_BrowserV::handle()               - Handle events in the widget.
 //   Fl_Image_BrowserV::resize()               - Resize the image display widget.
+//   Fl_Image_BrowserV::relayout_cb()          - Do a relayout deferred by resize().
+//   Fl_Image_BrowserV::background_cb()        - Load thumbnails and reconcile at idle time.
+//   Fl_Image_BrowserV::reconcile()            - Bring a manifest's items up to date.
 //   Fl_Image_BrowserV::scrollbar_cb()         - Update the display based on the scrollbar position.
 //   Fl_Image_BrowserV::update_scrollbar()     - Update the scrollbar.
 //   Fl_Image_BrowserV::add()                  - Add an image to the browser.
@@ -28,8 +31,14 @@
 //   Fl_Image_BrowserV::insert_item()          - Insert an item in the browser.
 //   Fl_Image_BrowserV::move_item()            - Move an image in the browser.
 //   Fl_Image_BrowserV::load()                 - Load all images in a directory.
+//   Fl_Image_BrowserV::loadManifest()         - Load a directory from its session manifest.
 //   Fl_Image_BrowserV::load_item()            - Load the image for an item.
 //   Fl_Image_BrowserV::remove()               - Remove an item.
+//   Fl_Image_BrowserV::sort()                 - Sort the items.
+//   Fl_Image_BrowserV::duplicates()           - Find groups of near-duplicate items.
+//   composite_tile()                          - Draw part of a tile into a band of a contact sheet.
+//   Fl_Image_BrowserV::export_sheet()         - Write the layout as one image.
+//   Fl_Image_BrowserV::fetch()                - Fetch the thumbnail for an item.
 //   Fl_Image_BrowserV::ITEM::save_thumbnail() - Save the thumbnail image.
 //   Fl_Image_BrowserV::select()               - Select an image.
 //
@@ -43,8 +52,44 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <FL/filename.H>
+#include <math.h>
+#include <omp.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "Fl_Image_Browser.H"
+#include "ImageProbe.h"
+#include "Manifest.h"
+#include "SheetWriter.h"
+
+
+// Work done a bit at a time from an idle callback: loading thumbnails
+// which insert_item() didn't, and checking a directory which was opened
+// from its manifest against the real thing.
+//
+struct Fl_Image_BrowserV::Background
+{
+  bool    reconciling;   // directory check in progress
+  dirent  **files;       // directory contents, once listed
+  int     numFiles;
+  int     nextFile;      // next directory entry to check
+  bool    relayout;      // item sizes changed, or items added/removed
+  int     wantFirst;     // viewport when thumbnails were last fetched
+  int     wantLast;
+
+  // items from the manifest which haven't been seen in the directory
+  std::unordered_map<std::string, ItemList::ITEM *> unseen;
+};
+
+// Seconds on a monotonic clock, for time-slicing background work.
+static double now()
+{
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
 
 
 //
@@ -64,6 +109,8 @@ Fl_Image_BrowserV::Fl_Image_BrowserV(
   end();
 
   _itemList = new ItemList();
+  _itemList->thumbnailCallback(thumbnail_cb, this);
+  _model = _itemList;
   
   box(FL_DOWN_BOX);
   selection_color(FL_SELECTION_COLOR);
@@ -77,6 +124,23 @@ Fl_Image_BrowserV::Fl_Image_BrowserV(
   scrollbar_.callback(scrollbar_cb, this);
 
   _numLines = 2; // KBR NOTE *must* be set before resize
+  _stackMode = false;
+  _maxExtent = 0;
+
+  _updateDepth = 0;
+  _updateAdded = false;
+
+  _relayoutPending = false;
+  _anchorItem = -1;
+  _anchorFrac = 0.0;
+
+  _dirname = nullptr;
+  _background = nullptr;
+
+  _tiles = new TileCache();
+
+  _frameBudget = 0.012; // leaves room for the rest of a 60Hz frame
+  _frameStart  = 0.0;
   
   resize(X, Y, W, H);
 }
@@ -88,6 +152,13 @@ Fl_Image_BrowserV::Fl_Image_BrowserV(
 
 Fl_Image_BrowserV::~Fl_Image_BrowserV()
 {
+  Fl::remove_timeout(relayout_cb, this);
+  Fl::remove_idle(refine_cb, this);
+  saveManifest();
+  stopBackground();
+  free(_dirname);
+  delete _tiles;
+  _itemList->flush(); // thumbnails still queued for the cache
   _itemList->clear();
   // unnecessary widget update cause we're shutting down clear();
   delete _itemList;
@@ -97,32 +168,60 @@ Fl_Image_BrowserV::~Fl_Image_BrowserV()
 void Fl_Image_BrowserV::drawGrid(int X, int Y, int W, int H)
 {
   int ts = thumbSize();
-  
-  for (int i = 0; i < _itemList->count(); i ++)
-  {
-    ItemList::ITEM *item = _itemList->getUnsafe(i);
+  if (ts < 1)
+    return;
+
+  // Grid tiles are placed by index: only walk the visible rows
+  int first = scrollbar_.value() / ts * _numLines;
+  int last  = std::min(_model->count(),
+                       ((scrollbar_.value() + H) / ts + 1) * _numLines);
+  std::vector<int> misses;
+
+  // Tiles with a cached pixmap first, they are cheap
+  for (int i = first; i < last; i ++)
+    if (!drawGridItem(i, X, Y, H, false))
+      misses.push_back(i);
+
+  drawMisses(misses, X, Y, H);
+}
+
+// Draw a grid tile. Without 'render', a tile which isn't in the tile
+// cache is left undrawn (apart from its background) and false returned.
+//
+bool Fl_Image_BrowserV::drawGridItem(int i, int X, int Y, int H, bool render)
+{
+    int ts = thumbSize();
+    int xoff, yoff, tileW, tileH;
+    itemRect(i, xoff, yoff, tileW, tileH);
+    yoff -= scrollbar_.value();
 
-    if (!item || !item->thumbnail)
-      continue; // TODO label drawing, placeholder drawing
-      
-    int yoff = item->_y - scrollbar_.value();
-            
 //    int row = i / _numLines;
     
 //    int yoff = row * ts - scrollbar_.value();
 //    int xoff = i % _numLines * ts; // : 0;
     
     if (yoff < -ts || yoff >= H)
-      continue;
+      return true;
+
+    // The thumbnail itself is only unpacked if its tile must be rendered
+    const void *key = _model->thumbnailKey(i); // TODO label drawing
+    bool selected = _model->isSelected(i);
+    int changed = _model->changed(i);
+
+    if (!key)
+    {
+      drawPlaceholder(i, X + xoff, Y + yoff, tileW, tileH);
+      return true;
+    }
 
     Fl_Color bg;
 
-    if (item->selected)
-      bg = item->changed ?
+    if (selected)
+      bg = changed ?
                fl_color_average(FL_RED, selection_color(), 0.5) :
                selection_color();
     else
-      bg = item->changed ? FL_RED : FL_WHITE; // TODO chosen background color?
+      bg = changed ? FL_RED : FL_WHITE; // TODO chosen background color?
     
 //    int ts = thumbSize();
 
@@ -131,60 +230,77 @@ void Fl_Image_BrowserV::drawGrid(int X, int Y, int W, int H)
     // selected item is drawn smaller so selection color will show. otherwise, no margin.
     
     //int margin = 20; // TODO original margins
-    //int drawsize = item->selected ? ts - margin : ts;
-    //int delta    = item->selected ? 10 : 0;
+    //int drawsize = selected ? ts - margin : ts;
+    //int delta    = selected ? 10 : 0;
     
-    int drawsize = item->selected ?  ts - 10 : ts;
-    int delta = item->selected ? 5 : 0;
+    int drawsize = selected ?  ts - 10 : ts;
+    int delta = selected ? 5 : 0;
 
-    int tW = drawsize;
-    int tH = tW * item->thumbnail->h() / item->thumbnail->w();
-    
-    int xoff = item->_x;
-    
     if (bg != FL_WHITE) // TODO chosen background color?
     {
         fl_color(bg);
         fl_rectf(X + xoff + 1, Y + yoff + 1, ts - 3, ts - 3);
     }
     
-    //if (item->thumbnail->h() > item->thumbnail->w())
-    if (item->thumbnail->h() < item->thumbnail->w())
+    // A tile drawn before is copied from its pixmap on the display side
+    if (!_tiles->draw(_model->id(i), key, drawsize, drawsize,
+                      X + xoff + delta, Y + yoff + delta))
     {
-        tH = drawsize;
-        tW = tH * item->thumbnail->w() / item->thumbnail->h();
-    }        
-    
-    auto tmpImage = item->thumbnail->copy(tW,tH);
+      if (!render)
+        return false;
+
+      Fl_Image *thumb = _model->thumbnail(i);
+      if (!thumb)
+        return true;
+
+      int tW = drawsize;
+      int tH = tW * thumb->h() / thumb->w();
+
+      //if (thumb->h() > thumb->w())
+      if (thumb->h() < thumb->w())
+      {
+          tH = drawsize;
+          tW = tH * thumb->w() / thumb->h();
+      }        
+
+      auto tmpImage = thumb->copy(tW,tH);
         
-    // grid mode is centered+cropped: draw anti-proportional then take center(drawsize,drawsize)   
-    tmpImage->draw(X + xoff + delta, Y+yoff+delta,
-                drawsize, drawsize, (tW - drawsize) / 2, (tH - drawsize) / 2);
-    tmpImage->release();
+      // grid mode is centered+cropped: draw anti-proportional then take center(drawsize,drawsize)   
+      _tiles->draw(_model->id(i), key, tmpImage, drawsize, drawsize,
+                   (tW - drawsize) / 2, (tH - drawsize) / 2,
+                   X + xoff + delta, Y + yoff + delta);
+      tmpImage->release();
+    }
 
 #if 0 // KBR draw no label      
     fl_color(fl_contrast(FL_BLACK, bg));
     fl_font(textfont(), textsize());
-    fl_draw(item->label, X + xoff + 2, Y, ITEMWIDTH - 4, H - 2,
+    fl_draw(_model->name(i), X + xoff + 2, Y, ITEMWIDTH - 4, H - 2,
             (Fl_Align)(FL_ALIGN_INSIDE | FL_ALIGN_BOTTOM |
 	               FL_ALIGN_CLIP | FL_ALIGN_WRAP));
 #endif	               
-  }
+    return true;
 }
 
 void Fl_Image_BrowserV::drawStack(int X, int Y, int W, int H)
 {
-  int ts = thumbSize();
-  
-  for (int i = 0; i < _itemList->count(); i ++)
-  {
-    ItemList::ITEM *item = _itemList->getUnsafe(i);
+  int count = stackCount();
+  std::vector<int> misses;
 
-    if (!item || !item->thumbnail)
-      continue;
+  for (int i = 0; i < count; i ++)
+    if (!drawStackItem(i, X, Y, H, false))
+      misses.push_back(i);
+
+  drawMisses(misses, X, Y, H);
+}
 
-    int xoff = item->_x;
-    int yoff = item->_y - scrollbar_.value();
+// See drawGridItem().
+//
+bool Fl_Image_BrowserV::drawStackItem(int i, int X, int Y, int H, bool render)
+{
+    int ts = thumbSize();
+    int xoff = _stackX[i];
+    int yoff = _stackY[i] - scrollbar_.value();
     
 //    int row = i / _numLines;
     
@@ -194,39 +310,51 @@ void Fl_Image_BrowserV::drawStack(int X, int Y, int W, int H)
     //if (yoff < -ts || yoff >= H)
     //  continue;
     if (yoff >= H)
-      continue;
-    if (yoff + item->_h < 0)
-        continue;
+      return true;
+    if (yoff + _stackH[i] < 0)
+        return true;
+
+    // As in drawGridItem(), only unpacked to render its tile
+    const void *key = _model->thumbnailKey(i);
+    bool selected = _model->isSelected(i);
+    int changed = _model->changed(i);
+
+    // Layout comes from the probed image size: the tile is already in
+    // its final position even without a thumbnail
+    if (!key)
+    {
+        drawPlaceholder(i, X + xoff, Y + yoff, ts, _stackH[i]);
+        return true;
+    }
 
     Fl_Color bg;
 
-    if (item->selected)
-      bg = item->changed ?
+    if (selected)
+      bg = changed ?
                fl_color_average(FL_RED, selection_color(), 0.5) :
                selection_color();
     else
-      bg = item->changed ? FL_RED : FL_WHITE; // TODO chosen background color?
+      bg = changed ? FL_RED : FL_WHITE; // TODO chosen background color?
     
         // TODO drawing double margin horizontally [once on right of image x, once on left of image x+1]
         // TODO margins setting
         // selected item is drawn smaller so selection color will show. otherwise, no margin.
         
         //int margin = 20; // TODO original margins
-        //int drawsize = item->selected ? ts - margin : ts;
-        //int delta    = item->selected ? 10 : 0;
+        //int drawsize = selected ? ts - margin : ts;
+        //int delta    = selected ? 10 : 0;
         
-        int drawsize = item->selected ?  ts - 10 : ts;
-        int delta = item->selected ? 5 : 0;
+        int drawsize = selected ?  ts - 10 : ts;
+        int delta = selected ? 5 : 0;
 
         int tW = drawsize;
-        int tH = tW * item->thumbnail->h() / item->thumbnail->w();
+        int tH = _stackH[i] * drawsize / ts; // same aspect as the layout
 
 #if 0        
         if (i >= _numLines)
         {
-            ItemList::ITEM *temAbove = _itemList->get(i-_numLines);
-            item->_y = temAbove->_y + temAbove->_h;
-            yoff = item->_y;
+            _stackY[i] = _stackY[i-_numLines] + _stackH[i-_numLines];
+            yoff = _stackY[i];
         }
 #endif
 
@@ -236,25 +364,186 @@ void Fl_Image_BrowserV::drawStack(int X, int Y, int W, int H)
             fl_rectf(X + xoff + 1, Y + yoff + 1, ts - 3, tH + 7);
         }
         
-        auto tmpImage = item->thumbnail->copy(tW,tH);
+        if (!_tiles->draw(_model->id(i), key, tW, tH, X + xoff + delta, Y + yoff + delta))
+        {
+            if (!render)
+                return false;
+
+            Fl_Image *thumb = _model->thumbnail(i);
+            if (!thumb)
+                return true;
+
+            auto tmpImage = thumb->copy(tW,tH);
         
-        // TODO yoff depends on thumbnails above me
-        tmpImage->draw(X + xoff + delta, Y+yoff+delta, tW, tH);
+            // TODO yoff depends on thumbnails above me
+            _tiles->draw(_model->id(i), key, tmpImage, tW, tH, 0, 0,
+                         X + xoff + delta, Y + yoff + delta);
         
-        tmpImage->release();
+            tmpImage->release();
+        }
 
 #if 0 // KBR draw no label      
     fl_color(fl_contrast(FL_BLACK, bg));
     fl_font(textfont(), textsize());
-    fl_draw(item->label, X + xoff + 2, Y, ITEMWIDTH - 4, H - 2,
+    fl_draw(_model->name(i), X + xoff + 2, Y, ITEMWIDTH - 4, H - 2,
             (Fl_Align)(FL_ALIGN_INSIDE | FL_ALIGN_BOTTOM |
 	               FL_ALIGN_CLIP | FL_ALIGN_WRAP));
 #endif	               
-  }
-    
+    return true;
+}
+
+
+// Has this frame used up its time for rendering tiles?
+//
+bool Fl_Image_BrowserV::overBudget()
+{
+    return _frameBudget > 0.0 && now() - _frameStart > _frameBudget;
+}
+
+
+// Render the tiles which weren't in the tile cache, while the frame
+// budget lasts. The others get a stand-in and are rendered at idle time
+// [drawRefine()], so scrolling keeps its frame rate however many tiles
+// are new.
+//
+void Fl_Image_BrowserV::drawMisses(const std::vector<int> &misses, int X, int Y, int H)
+{
+    for (int i : misses)
+    {
+        if (overBudget())
+        {
+            int tX, tY, tW, tH;
+            itemRect(i, tX, tY, tW, tH);
+            drawPlaceholder(i, X + tX, Y + tY - scrollbar_.value(), tW, tH);
+            _unrefined.push_back(i);
+        }
+        else if (_stackMode)
+            drawStackItem(i, X, Y, H);
+        else
+            drawGridItem(i, X, Y, H);
+    }
+
+    if (!_unrefined.empty() && !Fl::has_idle(refine_cb, this))
+        Fl::add_idle(refine_cb, this);
+}
+
+
+// Render tiles drawn as stand-ins [FL_DAMAGE_USER2], as many as fit in
+// the frame budget; the rest wait for the next idle call.
+//
+void Fl_Image_BrowserV::drawRefine(int X, int Y, int W, int H)
+{
+    std::vector<int> todo;
+    todo.swap(_unrefined);
+
+    fl_push_clip(X, Y, W, H);
+
+    for (int i : todo)
+    {
+        if (outOfRange(i))
+            continue;
+
+        int tX, tY, tW, tH;
+        itemRect(i, tX, tY, tW, tH);
+        tY -= scrollbar_.value();
+
+        if (tY >= H || tY + tH <= 0) // scrolled away
+            continue;
+
+        if (overBudget())
+        {
+            _unrefined.push_back(i);
+            continue;
+        }
+
+        fl_push_clip(X + tX, Y + tY, tW, tH);
+
+        fl_color(color());
+        fl_rectf(X + tX, Y + tY, tW, tH);
+
+        if (_stackMode)
+            drawStackItem(i, X, Y, H);
+        else
+            drawGridItem(i, X, Y, H);
+
+        fl_pop_clip();
+    }
+
+    fl_pop_clip();
+
+    if (!_unrefined.empty() && !Fl::has_idle(refine_cb, this))
+        Fl::add_idle(refine_cb, this);
 }
 
 
+// Idle callback: render the stand-in tiles of the last frame.
+//
+void Fl_Image_BrowserV::refine_cb(void *d)
+{
+    Fl_Image_BrowserV *widget = (Fl_Image_BrowserV *)d;
+
+    Fl::remove_idle(refine_cb, d);
+    widget->damage(FL_DAMAGE_USER2);
+}
+
+
+// Redraw just the tiles whose selection or changed state changed
+// [FL_DAMAGE_USER1], each clipped to its own rectangle.
+//
+void Fl_Image_BrowserV::drawDirty(int X, int Y, int W, int H)
+{
+    std::vector<int> &dirty = _model->dirty();
+
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    fl_push_clip(X, Y, W, H);
+
+    for (int i : dirty)
+    {
+        if (outOfRange(i))
+            continue;
+
+        int tX, tY, tW, tH;
+        itemRect(i, tX, tY, tW, tH);
+        tY -= scrollbar_.value();
+
+        if (tY >= H || tY + tH <= 0 || !fl_not_clipped(X + tX, Y + tY, tW, tH))
+            continue;
+
+        fl_push_clip(X + tX, Y + tY, tW, tH);
+
+        fl_color(color());
+        fl_rectf(X + tX, Y + tY, tW, tH);
+
+        if (_stackMode)
+            drawStackItem(i, X, Y, H);
+        else
+            drawGridItem(i, X, Y, H);
+
+        fl_pop_clip();
+    }
+
+    fl_pop_clip();
+}
+
+
+
+// Stand-in for a thumbnail which isn't available (yet). Makes sure the
+// idle-time loader will fetch it.
+//
+void Fl_Image_BrowserV::drawPlaceholder(int i, int X, int Y, int W, int H)
+{
+    if (!_model->fetched(i))
+        startBackground();
+
+    if (W < 8 || H < 8)
+        return;
+
+    fl_color(fl_color_average(color(), FL_BLACK, 0.85f));
+    fl_rectf(X + 4, Y + 4, W - 8, H - 8);
+}
+
 
 //
 // 'Fl_Image_BrowserV::draw()' - Draw the image display widget.
@@ -271,6 +560,23 @@ Fl_Image_BrowserV::draw()
   //int H = h() - Fl::box_dh(box()) - SBWIDTH;
   int H = h() - Fl::box_dh(box());
 
+  _frameStart = now();
+
+  // Only selection/changed state of some tiles is different, or stand-in
+  // tiles are due to be rendered
+  if (!(damage() & ~(FL_DAMAGE_USER1 | FL_DAMAGE_USER2 | FL_DAMAGE_CHILD)))
+  {
+    drawDirty(X, Y, W, H);
+    _model->clearDirty();
+
+    if (damage() & FL_DAMAGE_USER2)
+      drawRefine(X, Y, W, H);
+
+    if (damage() & FL_DAMAGE_CHILD)
+      update_child(scrollbar_);
+    return;
+  }
+
   if (damage() & FL_DAMAGE_SCROLL)
     fl_push_clip(X, Y, W, H);
 
@@ -284,6 +590,8 @@ Fl_Image_BrowserV::draw()
   printf("scrollbar_.value() = %d\n", scrollbar_.value());
 #endif // DEBUG
 
+  _unrefined.clear(); // everything is drawn anew
+
     if (_stackMode)
         drawStack(X, Y, W, H);
     else
@@ -291,6 +599,8 @@ Fl_Image_BrowserV::draw()
 
   fl_pop_clip();
 
+  _model->clearDirty(); // all drawn
+
   if (damage() & FL_DAMAGE_SCROLL)
     update_child(scrollbar_);
   else
@@ -319,24 +629,25 @@ Fl_Image_BrowserV::handle(int event)	// I - Event
         
         // thumb values don't take scroll position into account
         Y += scrollbar_.value(); // vertical
-        int sel = _itemList->find(X, Y); // currently selected item
+        int sel = itemAt(X, Y); // currently selected item
                 
         pushed_ = sel; // TODO for drag?
 
         if (sel >= 0)
         {
             if (Fl::event_state() & FL_CTRL)
-                _itemList->toggleSelect(sel); // TODO selected_ state?
+                _model->toggleSelect(sel); // TODO selected_ state?
             else if (Fl::event_state() & FL_SHIFT)
             {
                 if (selected_ < 0)
                     selected_ = 0;
-                _itemList->selectRange(sel, selected_);
+                _model->selectRange(sel, selected_);
             }
-            else if (!_itemList->isSelected(sel))
+            else if (!_model->isSelected(sel))
             {
-                _itemList->select(sel); // select only said item
+                _model->select(sel); // select only said item
                 selected_ = sel;
+                _model->prefetch(sel, 0);
             }
 
             take_focus();
@@ -434,27 +745,36 @@ Fl_Image_BrowserV::handle(int event)	// I - Event
 */
     case FL_SHORTCUT :
     case FL_KEYDOWN :
+    {
+      int step;
+
       if (Fl::event_key() == FL_Left && selected_ > 0)
-        selected_ --;
-      else if (Fl::event_key() == FL_Right && selected_ < (_itemList->count() - 1))
-	    selected_ ++;
+        step = -1;
+      else if (Fl::event_key() == FL_Right && selected_ < (_model->count() - 1))
+	    step = 1;
 	  else
         return 1; // do NOT pass the keystroke to Fl_Group
 	    //break;
 
+      selected_ += step;
+
       if (Fl::event_state() & FL_SHIFT)
       {
-          _itemList->forceSelect(selected_); // add to selected
+          _model->forceSelect(selected_); // add to selected
       }
 	  else
 	  {
-          _itemList->select(selected_); // only the one selected
+          _model->select(selected_); // only the one selected
 	  }
 
       make_visible(selected_);
 
+      // Decode the full images the viewer is heading for
+      _model->prefetch(selected_, step);
+
       do_callback();
 	  return (1);
+    }
 
     case FL_FOCUS :
     case FL_UNFOCUS :
@@ -475,18 +795,104 @@ Fl_Image_BrowserV::resize(int X,		// I - X position
             int W,		// I - Width
             int H)		// I - Height
 {
+  int oldSize = thumbSize();
+
+  // Remember what was at the top of the viewport before the first resize
+  // of an interactive drag, so it can stay there afterwards.
+  if (!_relayoutPending)
+    saveAnchor();
+
   Fl_Widget::resize(X, Y, W, H);
 
   //scrollbar_.resize(X, Y + H - SBWIDTH, W, SBWIDTH);  // horizontal
   scrollbar_.resize(X + W - SBWIDTH, Y, SBWIDTH, H);    // vertical
 
-  recalc();
-  //update_scrollbar();
+  if (thumbSize() == oldSize || !_stackMode)
+  {
+    // Same thumb size: nothing moves. Grid geometry comes from the
+    // index, so relayout is cheap and done at once.
+    if (thumbSize() != oldSize)
+    {
+      recalc();
+      restoreAnchor();
+    }
+    else
+      update_scrollbar();
+  }
+  else if (!_relayoutPending)
+  {
+    // Stack relayout touches every item: do it once per display refresh,
+    // not for every resize event of a window drag.
+    _relayoutPending = true;
+    Fl::add_timeout(1.0 / 60.0, relayout_cb, this);
+  }
 
   redraw();
 }
 
 
+//
+// 'Fl_Image_BrowserV::relayout_cb()' - Do a relayout deferred by resize().
+//
+
+void
+Fl_Image_BrowserV::relayout_cb(
+    void *d)				// I - Image browser
+{
+  Fl_Image_BrowserV	*widget = (Fl_Image_BrowserV *)d;
+
+  widget->_relayoutPending = false;
+  widget->recalc();
+  widget->restoreAnchor();
+  widget->redraw();
+}
+
+
+//
+// 'Fl_Image_BrowserV::saveAnchor()' - Remember the item at the top of the viewport.
+//
+
+void
+Fl_Image_BrowserV::saveAnchor()
+{
+  int X, Y, W, H;
+
+  _anchorItem = -1;
+  if (scrollbar_.value() <= 0)
+    return; // at the top: stay at the top
+
+  // First item overlapping the top edge, whichever column it is in
+  for (int col = 0; col < _numLines && _anchorItem < 0; col++)
+    _anchorItem = itemAt(col * thumbSize(), scrollbar_.value());
+
+  if (_anchorItem < 0)
+    return;
+
+  itemRect(_anchorItem, X, Y, W, H);
+  _anchorFrac = H > 0 ? (double)(scrollbar_.value() - Y) / H : 0.0;
+}
+
+
+//
+// 'Fl_Image_BrowserV::restoreAnchor()' - Scroll the anchor item back to the top.
+//
+
+void
+Fl_Image_BrowserV::restoreAnchor()
+{
+  int X, Y, W, H;
+
+  if (outOfRange(_anchorItem))
+  {
+    set_scrollbar(0);
+    return;
+  }
+
+  itemRect(_anchorItem, X, Y, W, H);
+  set_scrollbar(Y + (int)(_anchorFrac * H + 0.5));
+}
+
+
 //
 // 'Fl_Image_BrowserV::scrollbar_cb()' - Update the display based on the scrollbar position.
 //
@@ -499,6 +905,9 @@ Fl_Image_BrowserV::scrollbar_cb(
   Fl_Image_BrowserV	*widget = (Fl_Image_BrowserV *)d;
 
   widget->damage(FL_DAMAGE_SCROLL);
+
+  // The thumbnails wanted next depend on where the viewport is now
+  widget->startBackground();
 }
 
 
@@ -509,7 +918,7 @@ Fl_Image_BrowserV::scrollbar_cb(
 void
 Fl_Image_BrowserV::set_scrollbar(int scrollPos)	// I - New scroll position
 {
-  int numItems = _itemList->count();
+  int numItems = _model->count();
   
   if (numItems < 1)
   {
@@ -570,40 +979,115 @@ Fl_Image_BrowserV::update_scrollbar()
 
 
 //
-// 'Fl_Image_BrowserV::add()' - Add an image to the browser.
+// 'Fl_Image_BrowserV::add_to_end()' - Append an image without its thumbnail.
+//
+// Only the file's header is read. The thumbnail is made at idle time,
+// items nearest the viewport first [see background_cb()].
 //
 
-void Fl_Image_BrowserV::add_to_end(const char* filename)
+bool					// O - false if not added
+Fl_Image_BrowserV::add_to_end(const char* filename)	// I - File to add
 {
-  // TODO calling stat for each file very slow
-  // Only add non-empty or cached files!  
-  //struct stat	fileinfo;		// Information about file
-  //if ((!stat(filename, &fileinfo) && fileinfo.st_size))
-  _itemList->insert_item(filename, nullptr);
+  struct stat	fileinfo;		// Information about file
+  int		W = 0, H = 0;		// Image size
+
+
+  // Only add non-empty files!  
+  if (stat(filename, &fileinfo) || !fileinfo.st_size)
+    return false;
+
+  probe_image_size(filename, W, H);
+  _itemList->add_item(filename, W, H, fileinfo.st_mtime, fileinfo.st_size);
+
+  return true;
 }
 
 
+//
+// 'Fl_Image_BrowserV::add()' - Add an image to the browser.
+//
+
 void
 Fl_Image_BrowserV::add(
     const char      *filename,		// I - File to add
     Fl_Shared_Image *img)		// I - Cached image data
 {
-  struct stat	fileinfo;		// Information about file
 
+  if (img)
+    _itemList->insert_item(filename, img); // add to end of list
+  else if (!add_to_end(filename))
+    return;
+
+  itemsAdded();
+  startBackground();
+}
+
+
+//
+// 'Fl_Image_BrowserV::add()' - Add a list of images to the browser.
+//
+
+void
+Fl_Image_BrowserV::add(
+    const char * const *filenames,	// I - Files to add
+    int                count)		// I - Number of files
+{
+
+  beginUpdate();
+
+  _itemList->reserve(_itemList->count() + count);
+
+  for (int i = 0; i < count; i ++)
+    add(filenames[i]);
+
+  endUpdate();
+}
+
+
+//
+// 'Fl_Image_BrowserV::endUpdate()' - Finish a series of add() calls.
+//
+
+void
+Fl_Image_BrowserV::endUpdate()
+{
 
-  // Only add non-empty or cached files!  
-  if (img || (!stat(filename, &fileinfo) && fileinfo.st_size))
+  if (_updateDepth > 0)
+    _updateDepth --;
+
+  if (!_updateDepth && _updateAdded)
   {
-    _itemList->insert_item(filename, img); // add to end of list
-    
-    recalc();
-    //update_scrollbar();
-    
-    set_changed();
-    do_callback();
-    clear_changed();
-    damage(FL_DAMAGE_SCROLL);
+    _updateAdded = false;
+    itemsAdded();
+  }
+}
+
+
+//
+// 'Fl_Image_BrowserV::itemsAdded()' - Lay out and announce new items.
+//
+// Items are only ever appended, so the ones already laid out stay put.
+// Deferred until the end of an update.
+//
+
+void
+Fl_Image_BrowserV::itemsAdded()
+{
+
+  if (_updateDepth)
+  {
+    _updateAdded = true;
+    return;
   }
+
+  // Items are appended, so those already in a filter keep their places
+  listChanged(selectedId());
+  recalcAdded();
+
+  set_changed();
+  do_callback();
+  clear_changed();
+  damage(FL_DAMAGE_SCROLL);
 }
 
 
@@ -614,7 +1098,14 @@ Fl_Image_BrowserV::add(
 void
 Fl_Image_BrowserV::clear()
 {
+  saveManifest();
+  stopBackground();
+  free(_dirname);
+  _dirname = nullptr;
+
+  _tiles->clear();
   _itemList->clear();
+  listChanged(0);
   update_scrollbar();
   clear_changed();
   damage(FL_DAMAGE_SCROLL);
@@ -637,6 +1128,20 @@ Fl_Image_BrowserV::load(
 
   fl_filename_absolute(absdir, sizeof(absdir), dirname);
 
+  // Directory entries are unique, so only a list which already holds
+  // items needs checking for duplicates
+  bool wasEmpty = !_itemList->count();
+
+  // A directory opened before shows at once from its manifest
+  if (wasEmpty)
+  {
+    free(_dirname);
+    _dirname = strdup(absdir);
+
+    if (loadManifest(absdir))
+      return;
+  }
+
   num_files = fl_filename_list(dirname, &files);
 
   printf("L:#files:%d\n", num_files);
@@ -645,19 +1150,18 @@ Fl_Image_BrowserV::load(
   {
     window()->cursor(FL_CURSOR_WAIT);
 
+    _itemList->reserve(_itemList->count() + num_files);
+
     for (int i = 0; i < num_files; i ++)
     {
       snprintf(filename, sizeof(filename), "%s/%s", absdir, files[i]->d_name);
 
-      bool isNotFound = _itemList->find(filename) == -1;
+      bool isNotFound = wasEmpty || _itemList->find(filename) == -1;
       
       // Import all supported file formats *except* PPM to avoid cached
       // raw image files...
       if (isNotFound && !fl_filename_isdir(filename) && 
-          fl_filename_match(files[i]->d_name,
-	                    "*.{arw,avi,bay,bmp,bmq,cr2,crw,cs1,dc2,dcr,dng,"
-			    "erf,fff,hdr,jpg,k25,kdc,mdc,mos,nef,orf,pcd,pef,"
-			    "png,pxn,raf,raw,rdc,sr2,srf,sti,tif,x3f}"))
+          fl_filename_match(files[i]->d_name, ItemList::IMAGE_PATTERN))
       {
         if (window()->shown())
 	{
@@ -720,7 +1224,10 @@ Fl_Image_BrowserV::load(
     window()->cursor(FL_CURSOR_DEFAULT);
     
     set_scrollbar(0);
+    listChanged(selectedId());
     recalc();
+    saveManifest();
+    startBackground();
     
 //    int zoom = 1; // TODO more than one thumbnail row
 //    int tSize = (h() - SBWIDTH) / zoom;
@@ -731,6 +1238,367 @@ Fl_Image_BrowserV::load(
 
 
 
+//
+// 'Fl_Image_BrowserV::loadManifest()' - Load a directory from its session manifest.
+//
+// Items, layout and scroll position come from the manifest without reading
+// any image or thumbnail. Visible thumbnails are then loaded first, and
+// the directory is checked for changes, at idle time.
+//
+
+bool					// O - true if the manifest was used
+Fl_Image_BrowserV::loadManifest(
+    const char *dirname)		// I - Absolute directory name
+{
+  Manifest	manifest;		// Mapped manifest
+  char		filename[1024];		// Absolute filename path
+
+
+  if (!manifest.open(dirname))
+    return false;
+
+  for (int i = 0; i < manifest.count(); i++)
+  {
+    const Manifest::ENTRY &e = manifest.entry(i);
+
+    snprintf(filename, sizeof(filename), "%s/%s", dirname, manifest.name(i));
+    _itemList->add_item(filename, e.width, e.height, (time_t)e.mtime, (off_t)e.size);
+  }
+
+  listChanged(selectedId());
+  recalc();
+
+  _anchorItem = manifest.anchorItem();
+  _anchorFrac = manifest.anchorFrac();
+  restoreAnchor();
+
+  startBackground();
+  _background->reconciling = true;
+
+  damage(FL_DAMAGE_SCROLL);
+  return true;
+}
+
+
+//
+// 'Fl_Image_BrowserV::saveManifest()' - Save the session manifest for the directory shown.
+//
+
+void
+Fl_Image_BrowserV::saveManifest()
+{
+
+  // Nothing to save, or a directory check hasn't finished
+  if (!_dirname || !_itemList->count() || _model != _itemList ||
+      (_background && _background->reconciling))
+    return;
+
+  if (!_relayoutPending)
+    saveAnchor();
+
+  Manifest::save(_dirname, _itemList, _anchorItem, _anchorFrac);
+}
+
+
+//
+// 'Fl_Image_BrowserV::startBackground()' - Start (or restart) idle-time work.
+//
+
+void
+Fl_Image_BrowserV::startBackground()
+{
+
+  if (!_background)
+  {
+    _background = new Background;
+    _background->reconciling = false;
+    _background->files       = nullptr;
+    _background->numFiles    = 0;
+    _background->nextFile    = 0;
+    _background->relayout    = false;
+    _background->wantFirst   = -1;
+    _background->wantLast    = -1;
+  }
+
+  if (!Fl::has_idle(background_cb, this))
+    Fl::add_idle(background_cb, this);
+}
+
+
+//
+// 'Fl_Image_BrowserV::stopBackground()' - Cancel any idle-time work.
+//
+
+void
+Fl_Image_BrowserV::stopBackground()
+{
+
+  Fl::remove_idle(background_cb, this);
+
+  if (!_background)
+    return;
+
+  if (_background->files)
+  {
+    for (int i = 0; i < _background->numFiles; i ++)
+      free(_background->files[i]);
+
+    free(_background->files);
+  }
+
+  delete _background;
+  _background = nullptr;
+}
+
+
+//
+// 'Fl_Image_BrowserV::background_cb()' - Load thumbnails and reconcile at idle time.
+//
+// Each call does about 10ms of work so the UI stays responsive: first
+// quick previews for the viewport's thumbnails which have to be made,
+// then any missing thumbnails in the viewport, then the directory check,
+// then the thumbnails just outside the viewport.
+//
+// There is no job queue to keep up to date: the wanted items are worked
+// out from the viewport on every call, nearest first. Scrolling away
+// from items, or removing them, simply drops them from the work. A model
+// which fetches in the background [ItemList does, on ThumbLoader
+// workers] has its queued fetches cancelled when the viewport moves.
+//
+
+void
+Fl_Image_BrowserV::background_cb(
+    void *d)				// I - Image browser
+{
+  Fl_Image_BrowserV	*widget = (Fl_Image_BrowserV *)d;
+  Background		*bg = widget->_background;
+  ImageModel		*model = widget->_model;
+  double		until = now() + 0.010;
+  int			first, last;
+
+
+  // Visible tiles first, from the middle of the viewport out
+  bool painted = false;
+  widget->visibleRange(first, last);
+
+  // Fetches the model runs in the background, for where the viewport
+  // was, give way to those for where it is now
+  if (first != bg->wantFirst || last != bg->wantLast)
+  {
+    model->cancelFetch();
+    bg->wantFirst = first;
+    bg->wantLast  = last;
+  }
+
+  int mid = (first + last) / 2;
+
+  // A rough preview for every tile of a cold folder before the first
+  // full thumbnail, which takes much longer each
+  for (int d = 0; first <= last && d <= last - mid && now() < until; d ++)
+  {
+    if (mid + d <= last && !model->fetched(mid + d) && model->preview(mid + d))
+      painted = true;
+    if (d && mid - d >= first && !model->fetched(mid - d) && model->preview(mid - d))
+      painted = true;
+  }
+
+  if (painted)
+  {
+    widget->damage(FL_DAMAGE_SCROLL);
+    return;
+  }
+
+  for (int d = 0; first <= last && d <= last - mid && now() < until; d ++)
+  {
+    if (mid + d <= last && !model->fetched(mid + d))
+    {
+      widget->fetch(mid + d);
+      painted = true;
+    }
+    if (d && mid - d >= first && !model->fetched(mid - d))
+    {
+      widget->fetch(mid - d);
+      painted = true;
+    }
+  }
+
+  if (painted)
+  {
+    widget->damage(FL_DAMAGE_SCROLL);
+    return;
+  }
+
+  if (bg->reconciling)
+  {
+    widget->reconcile(until);
+    return;
+  }
+
+  // Then prefetch two screenfuls either side, nearest first. Items further
+  // away are only fetched once they come into view.
+  int span = std::max(1, last - first + 1);
+  bool pending = false;
+
+  for (int d = 1; d <= 2 * span && now() < until; d ++)
+  {
+    int below = last + d, above = first - d;
+
+    if (below < model->count() && !model->fetched(below))
+    {
+      widget->fetch(below);
+      pending = true;
+    }
+    if (above >= 0 && !model->fetched(above))
+    {
+      widget->fetch(above);
+      pending = true;
+    }
+  }
+
+  if (!pending)
+    widget->stopBackground();
+}
+
+
+//
+// 'Fl_Image_BrowserV::reconcile()' - Bring a manifest's items up to date.
+//
+// Adds files which are new, refreshes changed ones and removes those which
+// are gone. Returns true when the check is complete.
+//
+
+bool					// O - true when done
+Fl_Image_BrowserV::reconcile(
+    double until)			// I - Time to stop working
+{
+  Background	*bg = _background;
+  char		filename[1024];		// Absolute filename path
+  struct stat	fileinfo;		// Information about file
+
+
+  if (!bg->files)
+  {
+    // List the directory and note what the manifest gave us
+    bg->numFiles = fl_filename_list(_dirname, &bg->files);
+    bg->nextFile = 0;
+
+    if (bg->numFiles < 0)
+    {
+      bg->files    = nullptr;
+      bg->numFiles = 0;
+    }
+
+    bg->unseen.clear();
+    for (int i = 0; i < _itemList->count(); i ++)
+      if (!strcmp(_itemList->dirname(i), _dirname))
+        bg->unseen[_itemList->name(i)] = _itemList->getUnsafe(i);
+
+    if (now() >= until)
+      return false;
+  }
+
+  while (bg->nextFile < bg->numFiles && now() < until)
+  {
+    const char *name = bg->files[bg->nextFile ++]->d_name;
+
+    if (!fl_filename_match(name, ItemList::IMAGE_PATTERN))
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", _dirname, name);
+
+    if (fl_filename_isdir(filename) || stat(filename, &fileinfo) ||
+        !fileinfo.st_size)
+      continue;
+
+    auto it = bg->unseen.find(name);
+    if (it == bg->unseen.end())
+    {
+      // New file
+      if (_itemList->find(filename) >= 0)
+        continue;
+
+      int W, H;
+      probe_image_size(filename, W, H);
+      _itemList->add_item(filename, W, H, fileinfo.st_mtime, fileinfo.st_size);
+      bg->relayout = true;
+      continue;
+    }
+
+    ItemList::ITEM *item = it->second;
+    bg->unseen.erase(it);
+
+    if (item->mtime != fileinfo.st_mtime || item->size != fileinfo.st_size)
+    {
+      // Changed file: new size, and the images and tiles of the old
+      // contents go. The thumbnail will be remade.
+      int W = 0, H = 0, i = _itemList->index(item->id);
+      probe_image_size(filename, W, H);
+      if (i >= 0)
+        _itemList->refresh(i, fileinfo.st_mtime, fileinfo.st_size, W, H);
+      _tiles->remove(item->id);
+      bg->relayout = true;
+    }
+  }
+
+  if (bg->nextFile < bg->numFiles)
+    return false;
+
+  unsigned shown = selectedId();
+
+  // Remove items whose files are gone
+  if (!bg->unseen.empty())
+  {
+    std::unordered_set<ItemList::ITEM *> gone;
+    std::vector<int> indices;		// Items to remove
+    int              before = 0;	// Survivors before selected_
+
+    for (auto &it : bg->unseen)
+      gone.insert(it.second);
+
+    for (int i = 0; i < _itemList->count(); i ++)
+      if (gone.count(_itemList->getUnsafe(i)))
+      {
+        _tiles->remove(_itemList->getUnsafe(i)->id);
+        indices.push_back(i);
+
+        if (i == selected_)
+          before = -1;
+      }
+      else if (i < selected_)
+        before ++;
+
+    // The selection follows its item, as in remove_selected()
+    if (_model == _itemList && selected_ >= 0)
+      selected_ = before;
+
+    _itemList->remove(indices);
+
+    bg->unseen.clear();
+    bg->relayout = true;
+  }
+
+  for (int i = 0; i < bg->numFiles; i ++)
+    free(bg->files[i]);
+
+  free(bg->files);
+  bg->files       = nullptr;
+  bg->numFiles    = 0;
+  bg->reconciling = false;
+
+  if (bg->relayout)
+  {
+    bg->relayout = false;
+    listChanged(shown);
+    saveAnchor();
+    recalc();
+    restoreAnchor();
+    damage(FL_DAMAGE_SCROLL);
+  }
+
+  saveManifest();
+  return true;
+}
+
 //
 // 'Fl_Image_BrowserV::remove()' - Remove an item.
 //
@@ -738,12 +1606,444 @@ Fl_Image_BrowserV::load(
 void
 Fl_Image_BrowserV::remove(int i)		// I - Index to remove
 {
+  unsigned shown = selectedId();
+
+
+  if (_itemList->outOfRange(i))
+    return;
+
+  forget(i);
+
+  if (_model == _itemList && selected_ >= i)
+    selected_ = selected_ == i ? -1 : selected_ - 1;
+
   _itemList->delete_item(i);
-  update_scrollbar();
+  listChanged(shown);
+  recalc();
+  redraw();
+}
+
+
+//
+// 'Fl_Image_BrowserV::remove_selected()' - Remove the selected items.
+//
+
+int					// O - Number of items removed
+Fl_Image_BrowserV::remove_selected()
+{
+  unsigned shown  = selectedId();	// Selected item, for another model
+  int      before = 0;			// Survivors before selected_
+
+
+  for (int i = 0; i < _itemList->count(); i ++)
+    if (_itemList->isSelected(i))
+      forget(i);
+    else if (i < selected_)
+      before ++;
+
+  if (_model == _itemList && selected_ >= 0)
+    selected_ = _itemList->isSelected(selected_) ? -1 : before;
+
+  int removed = _itemList->remove_selected();
+
+  if (removed)
+  {
+    listChanged(shown);
+    recalc();
+    redraw();
+  }
+
+  return (removed);
+}
+
+
+//
+// 'Fl_Image_BrowserV::move_selected()' - Move the selected items together.
+//
+// See ItemList::move_selected().
+//
+
+void
+Fl_Image_BrowserV::move_selected(int to)	// I - Item to move in front of
+{
+  unsigned shown = selectedId();
+  int      at    = _itemList->move_selected(to);
+
+  if (at < 0)
+    return;
+
+  if (_model == _itemList)
+    selected_ = at;
+
+  listChanged(shown);
+
+  recalc();
+  make_visible(at);
   redraw();
 }
 
 
+//
+// 'Fl_Image_BrowserV::sort()' - Sort the items.
+//
+// See ItemList::sort(). Tiles are kept, being cached by item id.
+//
+
+void
+Fl_Image_BrowserV::sort(ItemList::SORT by,	// I - Key
+                        bool descending)	// I - Largest first?
+{
+  unsigned shown = selectedId();
+  int      at    = _itemList->sort(by, descending, _model == _itemList ? selected_ : -1);
+
+  if (_model == _itemList)
+    selected_ = at;
+
+  listChanged(shown);
+
+  recalc();
+  if (selected_ >= 0)
+    make_visible(selected_);
+  redraw();
+}
+
+
+//
+// 'Fl_Image_BrowserV::duplicates()' - Find groups of near-duplicate items.
+//
+// See ItemList::duplicates(). Thumbnails it made at once are shown; the
+// rest as they come in [see thumbnail_cb()].
+//
+
+std::vector<std::vector<int> >		// O - Groups of item indices
+Fl_Image_BrowserV::duplicates(int maxDistance,	// I - Most differing hash bits
+                              int *pending)	// O - Items still being hashed, or NULL
+{
+  std::vector<unsigned> fetching;	// Thumbnails it may load
+
+  for (int i = 0; i < _itemList->count(); i ++)
+    if (!_itemList->fetched(i))
+      fetching.push_back(_itemList->id(i));
+
+  std::vector<std::vector<int> > groups = _itemList->duplicates(maxDistance, pending);
+
+  // Previews drawn before are replaced
+  for (unsigned id : fetching)
+    _tiles->remove(id);
+
+  damage(FL_DAMAGE_SCROLL);
+
+  return groups;
+}
+
+
+//
+// 'composite_tile()' - Draw part of a tile into a band of a contact sheet.
+//
+// Each sheet pixel is the average of the thumbnail pixels it covers, or
+// the nearest one when the tile is larger than the thumbnail. Grid tiles
+// show the middle square of the thumbnail, as drawGridItem() does.
+//
+
+struct SHEET_TILE
+{
+  int       x0, y0, x1, y1;	// sheet pixels covered, right/bottom excluded
+  Fl_Image *image;		// thumbnail, NULL for a placeholder
+};
+
+static void
+composite_tile(uchar            *band,		// IO - RGB rows of the band
+               int              width,		// I - Sheet width
+               int              top,		// I - First sheet row in the band
+               int              rows,		// I - Rows in the band
+               const SHEET_TILE &t,		// I - Tile
+               bool             crop,		// I - Crop to a square?
+               const uchar      *empty,		// I - Placeholder color
+               int              inset)		// I - Placeholder margin
+{
+  Fl_Image *image = t.image;
+
+  if (!image || image->count() != 1 || image->d() < 1 || !image->data())
+  {
+    // As drawPlaceholder(): an inset block, unless the tile is tiny
+    if (t.x1 - t.x0 <= 2 * inset || t.y1 - t.y0 <= 2 * inset)
+      return;
+
+    int yb = std::min(t.y1 - inset, top + rows);
+    for (int y = std::max(t.y0 + inset, top); y < yb; y ++)
+    {
+      uchar *out = band + ((size_t)(y - top) * width + t.x0 + inset) * 3;
+
+      for (int x = t.x0 + inset; x < t.x1 - inset; x ++, out += 3)
+        memcpy(out, empty, 3);
+    }
+    return;
+  }
+
+  int W  = image->w();
+  int H  = image->h();
+  int D  = image->d();
+  int LD = image->ld() ? image->ld() : W * D;
+  int G  = D < 3 ? 0 : 1; // gray images have a single channel [plus alpha]
+  const uchar *pixels = (const uchar *)image->data()[0];
+
+  int cx = 0, cy = 0, cw = W, ch = H;
+  if (crop && W > H)
+  {
+    cx = (W - H) / 2;
+    cw = H;
+  }
+  else if (crop)
+  {
+    cy = (H - W) / 2;
+    ch = W;
+  }
+
+  int dw = t.x1 - t.x0;
+  int dh = t.y1 - t.y0;
+
+  // First thumbnail column of each sheet column
+  std::vector<int> sx(dw + 1);
+  for (int c = 0; c <= dw; c ++)
+    sx[c] = cx + (int)((long long)c * cw / dw);
+
+  int yb = std::min(t.y1, top + rows);
+  for (int y = std::max(t.y0, top); y < yb; y ++)
+  {
+    int k   = y - t.y0;
+    int sy0 = cy + (int)((long long)k * ch / dh);
+    int sy1 = std::max(sy0 + 1, cy + (int)((long long)(k + 1) * ch / dh));
+    uchar *out = band + ((size_t)(y - top) * width + t.x0) * 3;
+
+    for (int c = 0; c < dw; c ++, out += 3)
+    {
+      int sx0 = sx[c];
+      int sx1 = std::max(sx0 + 1, sx[c + 1]);
+      unsigned r = 0, g = 0, b = 0;
+
+      for (int j = sy0; j < sy1; j ++)
+      {
+        const uchar *in = pixels + (size_t)j * LD + sx0 * D;
+
+        for (int i = sx0; i < sx1; i ++, in += D)
+        {
+          r += in[0];
+          g += in[G];
+          b += in[G + G];
+        }
+      }
+
+      unsigned n = (unsigned)(sy1 - sy0) * (sx1 - sx0);
+      out[0] = (uchar)(r / n);
+      out[1] = (uchar)(g / n);
+      out[2] = (uchar)(b / n);
+    }
+  }
+}
+
+
+//
+// 'Fl_Image_BrowserV::export_sheet()' - Write the layout as one image.
+//
+// The current grid or stack layout [see recalcGrid() and recalcStack()]
+// is scaled to 'width' and each tile composited from its thumbnail as it
+// is drawn unselected. The sheet is made SHEET_BAND rows at a time, a
+// band per OpenMP thread, and every finished band is compressed straight
+// to the file [see SheetWriter], so memory doesn't grow with the number
+// of items. The bands done together are also limited to those whose
+// thumbnails the model can keep at once [see ImageModel::keepBytes()],
+// overshooting by at most one band. No window or display is needed.
+//
+// Items without a thumbnail are fetched first, without waiting for idle
+// [see ImageModel::fetchNow()]; any the model still has none for become
+// placeholders.
+//
+
+#define SHEET_BAND 256
+
+bool					// O - false on error
+Fl_Image_BrowserV::export_sheet(const char *path,	// I - PNG or JPEG file
+                                int        width)	// I - Width in pixels
+{
+  recalc();
+
+  int ts    = thumbSize();
+  int count = _stackMode ? stackCount() : _model->count();
+
+  if (ts < 1 || width < 1 || _maxExtent < 1)
+    return false;
+
+  double scale  = (double)width / (_numLines * ts);
+  double height = ceil(_maxExtent * scale);
+
+  if (height > SheetWriter::maxSize(path))
+    return false;
+
+  // Edges are scaled rather than sizes, so neighbouring tiles stay flush
+  std::vector<SHEET_TILE>        tiles(count);
+  std::vector<std::vector<int> > bands(((int)height + SHEET_BAND - 1) / SHEET_BAND);
+
+  for (int i = 0; i < count; i ++)
+  {
+    int X, Y, W, H;
+    itemRect(i, X, Y, W, H);
+
+    SHEET_TILE &t = tiles[i];
+    t.x0    = (int)lround(X * scale);
+    t.y0    = (int)lround(Y * scale);
+    t.x1    = std::min(width, (int)lround((X + W) * scale));
+    t.y1    = std::min((int)height, (int)lround((Y + H) * scale));
+    t.image = NULL;
+
+    if (t.x1 > t.x0 && t.y1 > t.y0)
+      for (int b = t.y0 / SHEET_BAND; b <= (t.y1 - 1) / SHEET_BAND; b ++)
+        bands[b].push_back(i);
+  }
+
+  SheetWriter writer;
+
+  if (!writer.open(path, width, (int)height))
+    return false;
+
+  uchar back[3], empty[3];
+  Fl::get_color(color(), back[0], back[1], back[2]);
+  Fl::get_color(fl_color_average(color(), FL_BLACK, 0.85f), empty[0], empty[1], empty[2]);
+
+  int inset = std::max(1, (int)lround(4 * scale));
+  int group = std::max(1, omp_get_max_threads());
+  size_t bandBytes = (size_t)width * 3 * SHEET_BAND;
+  size_t keepBytes = _model->keepBytes();
+  std::vector<uchar> pixels(bandBytes * group);
+  std::vector<bool>  tried(count);
+  std::vector<int>   keptFor(count, -1);	// group an item was counted in
+
+  for (int first = 0, last; first < (int)bands.size(); first = last)
+  {
+    size_t kept = 0;			// thumbnail bytes kept for the group
+
+    // The model is only asked on this thread, and must keep every
+    // thumbnail it hands out until the bands are done
+    _model->keepThumbnails(true);
+
+    for (last = first; last < (int)bands.size() && last - first < group &&
+                       (!keepBytes || kept < keepBytes); last ++)
+      for (int i : bands[last])
+      {
+        if (!_model->thumbnail(i) && !tried[i])
+          fetch(i, true);
+
+        tried[i]       = true;
+        tiles[i].image = _model->thumbnail(i);
+
+        if (tiles[i].image && keptFor[i] != first)
+        {
+          keptFor[i] = first;
+          kept += (size_t)tiles[i].image->w() * tiles[i].image->h() *
+                  std::max(1, tiles[i].image->d());
+        }
+      }
+
+#pragma omp parallel for schedule(dynamic)
+    for (int b = first; b < last; b ++)
+    {
+      uchar *band = pixels.data() + (b - first) * bandBytes;
+      int   top   = b * SHEET_BAND;
+      int   rows  = std::min(SHEET_BAND, (int)height - top);
+
+      for (size_t p = 0; p < (size_t)width * rows; p ++)
+        memcpy(band + p * 3, back, 3);
+
+      for (int i : bands[b])
+        composite_tile(band, width, top, rows, tiles[i], !_stackMode, empty, inset);
+    }
+
+    _model->keepThumbnails(false);
+
+    // Bands are consecutive in 'pixels'
+    int rows = std::min((int)height, last * SHEET_BAND) - first * SHEET_BAND;
+
+    if (!writer.write(pixels.data(), rows))
+      return false;
+  }
+
+  return writer.close();
+}
+
+
+//
+// 'Fl_Image_BrowserV::fetch()' - Fetch the thumbnail for an item.
+//
+// The new thumbnail replaces any drawn before [a preview], perhaps at the
+// same address, so the item's tiles go rather than relying on the tile
+// cache's key to tell them apart. The same goes for a fetch which
+// finishes in the background [see thumbnailReady()].
+//
+
+void
+Fl_Image_BrowserV::fetch(int  i,	// I - Index
+                         bool now)	// I - Wait for it?
+{
+  if (now)
+    _model->fetchNow(i);
+  else
+    _model->fetch(i);
+
+  _tiles->remove(_model->id(i));
+}
+
+
+//
+// 'Fl_Image_BrowserV::forget()' - Drop what refers to an item about to go.
+//
+
+void
+Fl_Image_BrowserV::forget(int i)	// I - Index
+{
+
+  if (_itemList->outOfRange(i))
+    return;
+
+  ItemList::ITEM *item = _itemList->getUnsafe(i);
+
+  // Don't leave the directory check holding a deleted item
+  if (_background && _background->reconciling)
+  {
+    auto it = _background->unseen.find(item->label);
+    if (it != _background->unseen.end() && it->second == item)
+      _background->unseen.erase(it);
+  }
+
+  _tiles->remove(item->id);
+}
+
+
+
+//
+// 'Fl_Image_BrowserV::listChanged()' - Bring the shown model up to date with the item list.
+//
+// A model made from the list [a filter] may not have it change behind its
+// back, so it is refreshed after every change, and the selection follows
+// its item. The list itself keeps selected_ up to date as it goes.
+//
+
+void
+Fl_Image_BrowserV::listChanged(unsigned shown)	// I - selectedId() before the change
+{
+
+  if (_model == _itemList)
+    return;
+
+  _model->refresh();
+
+  selected_ = -1;
+  for (int i = 0; shown && i < _model->count(); i ++)
+    if (_model->id(i) == shown)
+    {
+      selected_ = i;
+      break;
+    }
+}
+
 
 //
 // 'Fl_Image_BrowserV::select()' - Select an image.
@@ -753,12 +2053,13 @@ void
 Fl_Image_BrowserV::select(int i)		// I - Index
 {
 
-  if (_itemList->outOfRange(i))
+  if (outOfRange(i))
       return;
   
-  _itemList->select(i);
+  _model->select(i);
   selected_ = i;
   make_visible(i);
+  _model->prefetch(i, 0);
 }
 
 
@@ -770,15 +2071,19 @@ void
 Fl_Image_BrowserV::make_visible(int i)	// I - Index
 {
 
-  ItemList::ITEM *tem = _itemList->getUnsafe(i);
-  if (!tem)
+  if (outOfRange(i))
       return;
 
+  int temX, temY, temW, temH;
+  itemRect(i, temX, temY, temW, temH);
+
   // vertical version
   int H = h();
-  int target = tem->_y + tem->_h / 2;  // vertical
+  int target = temY + temH / 2;  // vertical
+  int oldPos = scrollbar_.value();
+
   // don't move scrollbar if thumb already fully visible
-  if (scrollbar_.value() > tem->_y || (scrollbar_.value() + H) < (tem->_y + tem->_h))
+  if (scrollbar_.value() > temY || (scrollbar_.value() + H) < (temY + temH))
     set_scrollbar(target - h() / 2);
   
 #if 0  
@@ -797,51 +2102,126 @@ Fl_Image_BrowserV::make_visible(int i)	// I - Index
   if (X + thumbSize() >= currScrollMax)
       set_scrollbar(X - w()/2);
 #endif
-  damage(FL_DAMAGE_SCROLL);
+  // Without scrolling, only tiles whose selection changed need drawing
+  damage(scrollbar_.value() == oldPos ? FL_DAMAGE_USER1 : FL_DAMAGE_SCROLL);
 }
 
+// Each grid thumb is the same size, so geometry is computed from the
+// index [see itemRect()] and only the extent needs updating.
+//
 void Fl_Image_BrowserV::recalcGrid()
+{
+    int rows = (_model->count() + _numLines - 1) / _numLines; // round up
+    _maxExtent = rows * thumbSize();
+}
+
+// Position and size of an item's tile, in scrolled coordinates.
+//
+void Fl_Image_BrowserV::itemRect(int i, int &X, int &Y, int &W, int &H)
+{
+    if (_stackMode)
+    {
+        if (i >= stackCount()) // not laid out yet
+        {
+            X = Y = W = H = 0;
+            return;
+        }
+
+        X = _stackX[i];
+        Y = _stackY[i];
+        W = thumbSize();
+        H = _stackH[i];
+        return;
+    }
+
+    int ts = thumbSize();
+    X = i % _numLines * ts; // vertical
+    Y = i / _numLines * ts;
+    W = ts;
+    H = ts;
+}
+
+// Find the item at a position, in scrolled coordinates.
+//
+int Fl_Image_BrowserV::itemAt(int X, int Y)
 {
     int ts = thumbSize();
 
-    int count = _itemList->count();
-    for (int i = 0; i < count; i++)
+    if (_stackMode)
     {
-        ItemList::ITEM *tem = _itemList->getUnsafe(i);
-        if (!tem || !tem->thumbnail)
-            continue; 
+        for (int i = 0; i < stackCount(); i++)
+            if (X >= _stackX[i] && X < _stackX[i] + ts &&
+                Y >= _stackY[i] && Y < _stackY[i] + _stackH[i])
+                return i;
+        return -1;
+    }
 
-        // Each thumb is the same size
-        int row = i / _numLines;
-        
-        int yoff = row * ts;
-        int xoff = i % _numLines * ts; // vertical
-        
-        tem->_x = xoff;
-        tem->_y = yoff;
-        tem->_w = ts;
-        tem->_h = ts;
-        
-        int newval = tem->_y + tem->_h;
-        
-        // If we skipped any items, the max extent might be unexpected
-        _maxExtent = newval > _maxExtent ? newval : _maxExtent;
+    if (X < 0 || Y < 0 || ts < 1 || X >= _numLines * ts)
+        return -1;
+
+    int i = Y / ts * _numLines + X / ts;
+    return i < _model->count() ? i : -1;
+}
+
+// The range of items which are (at least partly) in the viewport. Empty
+// [last < first] if there are none.
+//
+void Fl_Image_BrowserV::visibleRange(int &first, int &last)
+{
+    int top = scrollbar_.value();
+    int bottom = top + h();
+
+    first = 0;
+    last = -1;
+
+    if (!_stackMode)
+    {
+        int ts = thumbSize();
+        if (ts < 1)
+            return;
+
+        first = top / ts * _numLines;
+        last = std::min(_model->count(), (bottom / ts + 1) * _numLines) - 1;
+        return;
+    }
+
+    // Stack columns fill in index order, so the visible items are a
+    // contiguous-ish run: take the span of those overlapping.
+    first = stackCount();
+    for (int i = 0; i < stackCount(); i++)
+    {
+        if (_stackY[i] + _stackH[i] > top && _stackY[i] < bottom)
+        {
+            first = std::min(first, i);
+            last = i;
+        }
     }
 }
 
-void Fl_Image_BrowserV::recalcStack()
+// Stack mode layout of the items from index 'from' on.
+//
+void Fl_Image_BrowserV::recalcStack(int from)
 {
-    int columnHigh[10]; // TODO max of 10 columns
-    for (int i=0; i < 10; i++) columnHigh[i] = 0;
-    
     int ts = thumbSize();
+    int count = _model->count();
 
-    for (int i = 0; i < _itemList->count(); i++)
+    // Carry on from the column heights left by the earlier items, unless
+    // they are gone
+    if (from <= 0 || from > (int)_stackY.size() ||
+        (int)_columnHigh.size() != _numLines)
     {
-        ItemList::ITEM *tem = _itemList->getUnsafe(i);
-        if (!tem || !tem->thumbnail)
-            continue; 
+        from = 0;
+        _columnHigh.assign(_numLines, 0);
+    }
+
+    std::vector<int> &columnHigh = _columnHigh;
 
+    _stackX.resize(count);
+    _stackY.resize(count);
+    _stackH.resize(count);
+
+    for (int i = from; i < count; i++)
+    {
         // Place the next thumb into the *shortest* column. 
         // This prevents wildly different column heights at
         // the end. "selection order" (e.g. via keyboard)
@@ -853,26 +2233,29 @@ void Fl_Image_BrowserV::recalcStack()
             
         int xoff = column * ts;
         
+        // The image size is known before the thumbnail is loaded, so
+        // the layout doesn't change when it arrives. Unknown sizes get
+        // a square tile.
         int tW = ts;
-        int tH = tW * tem->thumbnail->h() / tem->thumbnail->w();
+        int tH = ts;
+        int imgW, imgH;
+        if (_model->dimensions(i, imgW, imgH) && imgW > 0)
+            tH = (int)((long long)tW * imgH / imgW);
                 
-        tem->_x = xoff;
-        tem->_w = tW;
-        tem->_h = tH;
-        tem->_y = columnHigh[column]; // 0;
+        _stackX[i] = xoff;
+        _stackH[i] = tH;
+        _stackY[i] = columnHigh[column]; // 0;
 
 /*        
         // for consistent navigation feel
         if (i >= _numLines)
-        {
-            ItemList::ITEM *temAbove = _itemList->getUnsafe(i-_numLines);
-            tem->_y = temAbove->_y + temAbove->_h;
-        }
+            _stackY[i] = _stackY[i-_numLines] + _stackH[i-_numLines];
 */            
-        int newval = tem->_y + tem->_h;
+        int newval = _stackY[i] + _stackH[i];
         columnHigh[column] = newval;
     }
     
+    _maxExtent = 0;
     for (int i=0; i < _numLines; i++)
         _maxExtent = columnHigh[i] > _maxExtent ? columnHigh[i] : _maxExtent;
 }
@@ -890,6 +2273,82 @@ void Fl_Image_BrowserV::recalc()
     update_scrollbar();
 }
 
+// Items have been appended. Only they need a place in stack mode; a
+// pending resize relayout will place everything anyway.
+//
+void Fl_Image_BrowserV::recalcAdded()
+{
+    if (!_stackMode)
+        recalcGrid();
+    else if (!_relayoutPending)
+        recalcStack(stackCount());
+
+    update_scrollbar();
+}
+
+// Switch to another model; NULL is the built-in ItemList.
+//
+void Fl_Image_BrowserV::model(ImageModel *m)
+{
+    m = m ? m : _itemList;
+    if (m == _model)
+        return;
+
+    _model = m;
+    _tiles->clear();
+    selected_ = -1;
+    set_scrollbar(0);
+    modelChanged();
+}
+
+// Items were added to, removed from or reordered in the model.
+//
+void Fl_Image_BrowserV::modelChanged()
+{
+    if (selected_ >= _model->count())
+        selected_ = -1;
+
+    recalc();
+    startBackground();
+    redraw();
+}
+
+// A thumbnail the built-in ItemList loaded in the background is in. i is
+// its ItemList index, which is only the model's when it is the model.
+// One it has left to make on the main thread is fetched again at idle.
+//
+void Fl_Image_BrowserV::thumbnail_cb(int i, void *d)
+{
+    Fl_Image_BrowserV *widget = (Fl_Image_BrowserV *)d;
+
+    if (!widget->_itemList->fetched(i))
+    {
+        widget->startBackground();
+        return;
+    }
+
+    if (widget->_model == widget->_itemList)
+        widget->thumbnailReady(i);
+    else
+    {
+        widget->_tiles->remove(widget->_itemList->id(i));
+        widget->damage(FL_DAMAGE_SCROLL);
+    }
+}
+
+// An asynchronous fetch() for item i has finished.
+//
+void Fl_Image_BrowserV::thumbnailReady(int i)
+{
+    _tiles->remove(_model->id(i)); // drawn from the preview, if any
+
+    int first, last;
+    visibleRange(first, last);
+
+    if (i >= first && i <= last)
+        damage(FL_DAMAGE_SCROLL);
+}
+
 void Fl_Image_BrowserV::numLines(int val) 
 { 
     if (_numLines == val) 
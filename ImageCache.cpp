@@ -0,0 +1,175 @@
+//
+// Byte limited cache of full size images.
+//
+// Contents:
+//
+//   ImageCache::find()   - Get a cached image, counting the hit or miss.
+//   ImageCache::peek()   - Get a cached image without using it.
+//   ImageCache::add()    - Cache an image.
+//   ImageCache::remove() - Drop an item's image.
+//   ImageCache::clear()  - Drop all images.
+//   ImageCache::pin()    - Set the items whose images are kept.
+//   ImageCache::evict()  - Release least recently used images over the limit.
+//
+
+#include "ImageCache.h"
+
+
+ImageCache::ImageCache(size_t maxBytes)
+{
+  bytes_     = 0;
+  maxBytes_  = maxBytes;
+  counter_   = 0;
+  hits_      = 0;
+  misses_    = 0;
+  evictions_ = 0;
+}
+
+ImageCache::~ImageCache()
+{
+  clear();
+}
+
+
+//
+// 'ImageCache::find()' - Get a cached image, counting the hit or miss.
+//
+
+Fl_Shared_Image *			// O - Image or NULL
+ImageCache::find(unsigned id)		// I - Item id
+{
+  auto it = images_.find(id);
+
+  if (it == images_.end())
+  {
+    misses_ ++;
+    return nullptr;
+  }
+
+  hits_ ++;
+  it->second.used = ++counter_;
+  return it->second.image;
+}
+
+
+//
+// 'ImageCache::peek()' - Get a cached image without using it.
+//
+
+Fl_Shared_Image *			// O - Image or NULL
+ImageCache::peek(unsigned id) const	// I - Item id
+{
+  auto it = images_.find(id);
+
+  return it == images_.end() ? nullptr : it->second.image;
+}
+
+
+//
+// 'ImageCache::add()' - Cache an image.
+//
+// The cache takes over the caller's reference. An image already cached
+// for the item is kept, and the new one released.
+//
+
+void
+ImageCache::add(unsigned        id,	// I - Item id
+                Fl_Shared_Image *image)	// I - Full size image
+{
+  ENTRY &entry = images_[id];
+
+  if (entry.image)
+  {
+    image->release();
+    return;
+  }
+
+  entry.image = image;
+  entry.bytes = (size_t)image->w() * image->h() * (image->d() ? image->d() : 1);
+  entry.used  = ++counter_;
+  bytes_ += entry.bytes;
+
+  evict();
+}
+
+
+//
+// 'ImageCache::remove()' - Drop an item's image.
+//
+
+void
+ImageCache::remove(unsigned id)		// I - Item id
+{
+  auto it = images_.find(id);
+
+  if (it == images_.end())
+    return;
+
+  bytes_ -= it->second.bytes;
+  it->second.image->release();
+  images_.erase(it);
+}
+
+
+//
+// 'ImageCache::clear()' - Drop all images.
+//
+
+void
+ImageCache::clear()
+{
+
+  for (auto &it : images_)
+    it.second.image->release();
+
+  images_.clear();
+  pinned_.clear();
+  bytes_ = 0;
+}
+
+
+//
+// 'ImageCache::pin()' - Set the items whose images are kept.
+//
+
+void
+ImageCache::pin(
+    const std::vector<unsigned> &ids)	// I - Item ids
+{
+
+  pinned_.clear();
+  pinned_.insert(ids.begin(), ids.end());
+
+  evict();
+}
+
+
+//
+// 'ImageCache::evict()' - Release least recently used images over the limit.
+//
+// Only a handful of full size images fit any sensible limit, so a linear
+// scan for the oldest is cheap enough.
+//
+
+void
+ImageCache::evict()
+{
+
+  while (bytes_ > maxBytes_)
+  {
+    auto oldest = images_.end();
+
+    for (auto it = images_.begin(); it != images_.end(); ++it)
+      if (!pinned_.count(it->first) &&
+          (oldest == images_.end() || it->second.used < oldest->second.used))
+        oldest = it;
+
+    if (oldest == images_.end()) // everything is pinned
+      return;
+
+    bytes_ -= oldest->second.bytes;
+    oldest->second.image->release();
+    images_.erase(oldest);
+    evictions_ ++;
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef _IMAGECACHE_H_
+#define _IMAGECACHE_H_
+
+#include <FL/Fl_Shared_Image.H>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Full size images, keyed by item id. Each entry holds one reference to
+// its image; once the cache exceeds its byte limit the least recently
+// used entries are let go with Fl_Shared_Image::release(). Pinned items
+// [the one shown, and those being prefetched] are never let go, even if
+// that leaves the cache over its limit.
+//
+// An image from find() stays valid while its item is pinned, or until
+// the next add() or pin().
+//
+class ImageCache
+{
+  struct ENTRY
+  {
+    Fl_Shared_Image *image;
+    size_t          bytes;
+    unsigned long   used;   // use counter when last found, for LRU
+  };
+
+  std::unordered_map<unsigned, ENTRY> images_;
+  std::unordered_set<unsigned>        pinned_;
+  size_t        bytes_;     // decoded pixels held
+  size_t        maxBytes_;
+  unsigned long counter_;
+  unsigned long hits_;
+  unsigned long misses_;
+  unsigned long evictions_;
+
+  void evict();
+
+public:
+  ImageCache(size_t maxBytes = 1024 * 1024 * 1024);
+  ~ImageCache();
+
+  Fl_Shared_Image *find(unsigned id);        // counts a hit or a miss
+  Fl_Shared_Image *peek(unsigned id) const;  // doesn't
+  void             add(unsigned id, Fl_Shared_Image *image);
+  void             remove(unsigned id);
+  void             clear();
+
+  // Replace the pinned items; ids need not be cached [yet]
+  void pin(const std::vector<unsigned> &ids);
+  bool pinned(unsigned id) const { return pinned_.count(id) != 0; }
+
+  size_t        bytes() const { return bytes_; }
+  size_t        maxBytes() const { return maxBytes_; }
+  void          maxBytes(size_t val) { maxBytes_ = val; evict(); }
+  size_t        count() const { return images_.size(); }
+  unsigned long hits() const { return hits_; }
+  unsigned long misses() const { return misses_; }
+  unsigned long evictions() const { return evictions_; }
+};
+
+#endif // _IMAGECACHE_H_
@@ -0,0 +1,195 @@
+//
+// Perceptual image hashes and near-duplicate grouping.
+//
+// Contents:
+//
+//   image_dhash()   - Get the difference hash of an image.
+//   find_root()     - Find the root of a union-find set.
+//   hash_clusters() - Group hashes within a distance of each other.
+//
+
+#include <algorithm> // sort
+#include <numeric>   // iota
+
+#include "ImageHash.h"
+
+typedef unsigned char uchar;
+
+
+//
+// 'image_dhash()' - Get the difference hash of an image.
+//
+// Each row is converted to gray and summed over the cells' column ranges
+// in loops the compiler vectorizes.
+//
+
+bool					// O - false if it can't be hashed
+image_dhash(Fl_Image *image,		// I - Image [usually a thumbnail]
+            uint64_t &hash)		// O - Hash
+{
+  double	sum[8][9] = {{ 0 }};	// Gray total per cell
+  int		count[8] = { 0 };	// Rows per cell row
+  int		left[10];		// First column of each cell
+
+
+  if (!image || image->count() != 1 || !image->d() || !image->data() ||
+      !image->w() || !image->h())
+    return false;
+
+  int W  = image->w();
+  int H  = image->h();
+  int D  = image->d();
+  int LD = image->ld() ? image->ld() : W * D;
+  int G  = D < 3 ? 0 : 1;		// Offset of green [gray images have one]
+
+  for (int c = 0; c <= 9; c ++)
+    left[c] = c * W / 9;
+
+  std::vector<int> gray(W);
+
+  for (int Y = 0; Y < H; Y ++)
+  {
+    const uchar *p   = (const uchar *)image->data()[0] + (size_t)Y * LD;
+    int         *row = gray.data();
+
+#pragma omp simd
+    for (int X = 0; X < W; X ++)
+      row[X] = (p[X * D] * 77 + p[X * D + G] * 150 + p[X * D + G + G] * 29) >> 8;
+
+    int cy = Y * 8 / H;
+
+    for (int c = 0; c < 9; c ++)
+    {
+      int total = 0;
+
+#pragma omp simd reduction(+:total)
+      for (int X = left[c]; X < left[c + 1]; X ++)
+        total += row[X];
+
+      sum[cy][c] += total;
+    }
+
+    count[cy] ++;
+  }
+
+  // Cells in a row have (nearly) the same number of pixels, but not
+  // always exactly: compare averages
+  hash = 0;
+
+  for (int cy = 0; cy < 8; cy ++)
+    for (int c = 0; c < 8; c ++)
+    {
+      int    n0 = left[c + 1] - left[c], n1 = left[c + 2] - left[c + 1];
+      double a  = n0 ? sum[cy][c] / n0 : 0.0;
+      double b  = n1 ? sum[cy][c + 1] / n1 : 0.0;
+
+      hash = (hash << 1) | (a > b);
+    }
+
+  return true;
+}
+
+
+//
+// 'find_root()' - Find the root of a union-find set.
+//
+// Halves the path on the way.
+//
+
+static int
+find_root(std::vector<int> &parent,	// IO - Parent of each set member
+          int              i)		// I - Member
+{
+  while (parent[i] != i)
+    i = parent[i] = parent[parent[i]];
+
+  return i;
+}
+
+
+//
+// 'hash_clusters()' - Group hashes within a distance of each other.
+//
+// Multi-index hashing: a BK-tree degenerates into visiting most of its
+// nodes at useful distances for 64-bit hashes.
+//
+
+std::vector<std::vector<int> >		// O - Groups, by first member
+hash_clusters(
+    const std::vector<uint64_t> &hashes,	// I - Hashes
+    int                         maxDistance)	// I - Most differing bits
+{
+  int n      = (int)hashes.size();
+  int chunks = std::min(std::max(maxDistance, 0) + 1, 64);
+  std::vector<std::pair<int, int> > pairs;	// Near hashes found
+
+
+  // Hashes within maxDistance bits agree exactly on at least one of
+  // maxDistance + 1 chunks, so only hashes sharing a chunk value are
+  // compared
+  for (int c = 0; c < chunks; c ++)
+  {
+    int      first = c * 64 / chunks, bits = (c + 1) * 64 / chunks - first;
+    uint64_t mask  = bits == 64 ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1) << first;
+    std::vector<std::pair<uint64_t, int> > bucket(n);	// Chunk, index
+
+    for (int i = 0; i < n; i ++)
+      bucket[i] = std::make_pair(hashes[i] & mask, i);
+
+    std::sort(bucket.begin(), bucket.end());
+
+    std::vector<int> starts;		// Where each chunk value starts
+    for (int i = 0; i < n; i ++)
+      if (!i || bucket[i].first != bucket[i - 1].first)
+        starts.push_back(i);
+    starts.push_back(n);
+
+#pragma omp parallel
+    {
+      std::vector<std::pair<int, int> > found;
+
+#pragma omp for schedule(dynamic, 16) nowait
+      for (int b = 0; b < (int)starts.size() - 1; b ++)
+        for (int i = starts[b]; i < starts[b + 1]; i ++)
+          for (int j = i + 1; j < starts[b + 1]; j ++)
+            if (hash_distance(hashes[bucket[i].second], hashes[bucket[j].second]) <= maxDistance)
+              found.push_back(std::make_pair(bucket[i].second, bucket[j].second));
+
+#pragma omp critical
+      pairs.insert(pairs.end(), found.begin(), found.end());
+    }
+  }
+
+  std::vector<int> parent(n);
+  std::iota(parent.begin(), parent.end(), 0);
+
+  for (auto &pair : pairs)
+  {
+    int a = find_root(parent, pair.first), b = find_root(parent, pair.second);
+
+    if (a != b)
+      parent[std::max(a, b)] = std::min(a, b);
+  }
+
+  // Roots are each group's smallest member, so groups come out in order
+  std::vector<std::vector<int> > groups;
+  std::vector<int>               group(n, -1);
+
+  for (int i = 0; i < n; i ++)
+  {
+    int root = find_root(parent, i);
+
+    if (root == i)
+      continue;
+
+    if (group[root] < 0)
+    {
+      group[root] = (int)groups.size();
+      groups.push_back(std::vector<int>(1, root));
+    }
+
+    groups[group[root]].push_back(i);
+  }
+
+  return groups;
+}
@@ -0,0 +1,26 @@
+#ifndef _IMAGEHASH_H_
+#define _IMAGEHASH_H_
+
+#include <FL/Fl_Image.H>
+#include <stdint.h>
+#include <vector>
+
+// Perceptual "difference hash" of an image: the image is reduced to 9 x 8
+// gray cells, and each of the 64 bits says whether a cell is brighter
+// than its right neighbour. Pictures which look alike [re-encoded,
+// resized, lightly retouched, or shot in a burst] differ in only a few
+// bits. false if the image has no pixel data to hash.
+//
+bool image_dhash(Fl_Image *image, uint64_t &hash);
+
+inline int hash_distance(uint64_t a, uint64_t b) { return __builtin_popcountll(a ^ b); }
+
+// Groups of two or more hashes within maxDistance bits of each other
+// [and so on, transitively], as indices into 'hashes' in ascending order.
+// Only hashes which agree exactly on one of maxDistance + 1 chunks are
+// compared, so each hash meets a small part of the set.
+//
+std::vector<std::vector<int> > hash_clusters(const std::vector<uint64_t> &hashes,
+                                             int maxDistance = 6);
+
+#endif // _IMAGEHASH_H_
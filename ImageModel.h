@@ -0,0 +1,83 @@
+#ifndef _IMAGEMODEL_H_
+#define _IMAGEMODEL_H_
+
+#include <FL/Fl_Image.H>
+#include <vector>
+
+// The items an Fl_Image_BrowserV shows. The widget only asks about the
+// indices it lays out, draws or prefetches, so a model can stand for a
+// very large catalog [or a database] without an object per item.
+// ItemList is the default implementation.
+//
+// Thumbnails are fetched asynchronously: the widget calls fetch() at idle
+// time for the items it wants, nearest the viewport first, and draws a
+// placeholder until thumbnail() returns one. A model which loads in the
+// background can start the work in fetch() and call
+// Fl_Image_BrowserV::thumbnailReady() when it is done.
+//
+class ImageModel
+{
+public:
+  virtual ~ImageModel() {}
+
+  virtual int         count() const = 0;
+  virtual const char *name(int i) = 0;
+
+  // Identity of an item which survives other items being added, removed
+  // or moved. Never reused.
+  virtual unsigned    id(int i) = 0;
+
+  // Full image size. false if not known [yet].
+  virtual bool        dimensions(int i, int &w, int &h) = 0;
+
+  // Thumbnail if one is available now, otherwise NULL. Must not block.
+  // May only be good until the next call [ItemList unpacks thumbnails
+  // into a small pool], unless keepThumbnails(true) is in force.
+  virtual Fl_Image   *thumbnail(int i) = 0;
+  // Stands for the thumbnail thumbnail() would return, for keying drawn
+  // copies of it: the same for as long as that thumbnail is, and had
+  // without unpacking it. NULL if there is no thumbnail.
+  virtual const void *thumbnailKey(int i) { return thumbnail(i); }
+  virtual void        keepThumbnails(bool keep) {}
+  // About how many bytes of kept thumbnails the model can stand; 0 if
+  // they cost nothing extra
+  virtual size_t      keepBytes() { return 0; }
+  virtual bool        fetched(int i) = 0;   // fetch() done or under way
+  virtual void        fetch(int i) = 0;
+
+  // Done on return [as far as it can be], for callers which can't wait
+  // for thumbnailReady()
+  virtual void        fetchNow(int i) { fetch(i); }
+
+  // Drop the fetch()es not started yet, which are no longer fetched().
+  // The widget calls it when the viewport moves, before asking again.
+  virtual void        cancelFetch() {}
+
+  // Before fetch(): make a quick, rough thumbnail to show meanwhile if
+  // the real one will take a while. true if one was made. Called once per
+  // item at most until it is fetched.
+  virtual bool        preview(int i) { return false; }
+
+  // Selection and changed state, with the items whose state changed
+  // since clearDirty() [see Fl_Image_BrowserV::draw()]
+  virtual bool        isSelected(int i) = 0;
+  virtual int         changed(int i) = 0;
+  virtual void        select(int i) = 0;        // only this one
+  virtual void        forceSelect(int i) = 0;   // add to the selection
+  virtual void        toggleSelect(int i) = 0;
+  virtual void        selectRange(int from, int to) = 0;
+  virtual void        clearSelect() = 0;
+
+  virtual std::vector<int> &dirty() = 0;
+  virtual void        clearDirty() = 0;
+
+  // The items the model was made from changed [such as the widget sorting
+  // its ItemList under a FilteredModel]: bring the model up to date.
+  virtual void        refresh() {}
+
+  // The viewer is at item i, moving by 'direction' (-1, 0 or 1): a model
+  // may start loading the full images it will be asked for next.
+  virtual void        prefetch(int i, int direction) {}
+};
+
+#endif // _IMAGEMODEL_H_
@@ -0,0 +1,230 @@
+//
+// Background decoding of full size images.
+//
+// Contents:
+//
+//   ImagePrefetcher::want()     - Set the images wanted, nearest first.
+//   ImagePrefetcher::take()     - Get a prefetched image now.
+//   ImagePrefetcher::deliver()  - Hand decoded images to the ready callback.
+//   ImagePrefetcher::awaken()   - Have the main thread deliver what is decoded.
+//   ImagePrefetcher::awake_cb() - Deliver on the main thread.
+//   ImagePrefetcher::run()      - Decode wanted images.
+//
+
+#include <FL/Fl.H>
+#include <algorithm> // find
+#include <set>
+
+#include "ImagePrefetcher.h"
+#include "ItemList.h"
+
+
+// Prefetchers not yet destroyed, as an Fl::awake() message can't be taken
+// back. Only used on the main thread.
+static std::set<ImagePrefetcher *> live;
+
+
+ImagePrefetcher::ImagePrefetcher(READY cb, void *data, int threads)
+{
+  awakening_  = false;
+  stop_       = false;
+  ready_cb_   = cb;
+  ready_data_ = data;
+
+  live.insert(this);
+
+  for (int i = 0; i < threads; i ++)
+    threads_.push_back(std::thread(&ImagePrefetcher::run, this));
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    wanted_.clear();
+  }
+
+  wake_.notify_all();
+  for (std::thread &thread : threads_)
+    thread.join();
+
+  for (DONE &done : ready_)
+    delete done.image;
+
+  live.erase(this);
+}
+
+
+//
+// 'ImagePrefetcher::want()' - Set the images wanted, nearest first.
+//
+// Images being decoded are finished either way.
+//
+
+void
+ImagePrefetcher::want(
+    std::vector<JOB> &&jobs)		// I - Images to decode, in order
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    wanted_.clear();
+    for (JOB &job : jobs)
+    {
+      // Already decoded or under way
+      if (std::find(busy_.begin(), busy_.end(), job.id) != busy_.end() ||
+          std::find_if(ready_.begin(), ready_.end(),
+                       [&job](const DONE &d) { return d.id == job.id; }) != ready_.end())
+        continue;
+
+      wanted_.push_back(std::move(job));
+    }
+  }
+
+  wake_.notify_all();
+  awaken(); // in case an Fl::awake() failed
+}
+
+
+//
+// 'ImagePrefetcher::take()' - Get a prefetched image now.
+//
+// An image still waiting its turn is dropped from the list for the caller
+// to decode; one being decoded is waited for.
+//
+
+Fl_RGB_Image *				// O - Image, owned by the caller, or NULL
+ImagePrefetcher::take(unsigned id)	// I - Item id
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  for (auto it = wanted_.begin(); it != wanted_.end(); ++it)
+    if (it->id == id)
+    {
+      wanted_.erase(it);
+      return nullptr;
+    }
+
+  done_.wait(lock, [this, id] {
+    return std::find(busy_.begin(), busy_.end(), id) == busy_.end();
+  });
+
+  for (auto it = ready_.begin(); it != ready_.end(); ++it)
+    if (it->id == id)
+    {
+      Fl_RGB_Image *image = it->image;
+      ready_.erase(it);
+      return image;
+    }
+
+  return nullptr;
+}
+
+
+//
+// 'ImagePrefetcher::deliver()' - Hand decoded images to the ready callback.
+//
+
+void
+ImagePrefetcher::deliver()
+{
+  std::vector<DONE> done;
+
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done.swap(ready_);
+    awakening_ = false;
+  }
+
+  for (DONE &d : done)
+    (*ready_cb_)(d.id, d.index, d.image, ready_data_);
+}
+
+
+//
+// 'ImagePrefetcher::awaken()' - Have the main thread deliver what is decoded.
+//
+// One Fl::awake() covers everything decoded until the main thread gets
+// around to delivering it. If it fails [FLTK's message queue is full],
+// the next want() or decoded image tries again.
+//
+
+void
+ImagePrefetcher::awaken()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (awakening_ || ready_.empty())
+      return;
+
+    awakening_ = true;
+  }
+
+  if (Fl::awake(awake_cb, this) != 0)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    awakening_ = false;
+  }
+}
+
+
+//
+// 'ImagePrefetcher::awake_cb()' - Deliver on the main thread.
+//
+
+void
+ImagePrefetcher::awake_cb(void *d)	// I - Prefetcher
+{
+  ImagePrefetcher *prefetcher = (ImagePrefetcher *)d;
+
+  if (live.count(prefetcher))
+    prefetcher->deliver();
+}
+
+
+//
+// 'ImagePrefetcher::run()' - Decode wanted images.
+//
+
+void
+ImagePrefetcher::run()
+{
+
+  for (;;)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    wake_.wait(lock, [this] { return stop_ || !wanted_.empty(); });
+
+    if (stop_)
+      return;
+
+    JOB job = std::move(wanted_.front());
+    wanted_.pop_front();
+    busy_.push_back(job.id);
+    lock.unlock();
+
+    // Without the Fl_Shared_Image fallback: the main thread uses its
+    // cache unlocked. Those formats, pixmaps and such are left to
+    // load_item().
+    Fl_Image     *image = ItemList::decode_image(job.filename.c_str(), false);
+    Fl_RGB_Image *rgb   = dynamic_cast<Fl_RGB_Image *>(image);
+
+    if (!rgb)
+      delete image;
+
+    lock.lock();
+    busy_.erase(std::find(busy_.begin(), busy_.end(), job.id));
+
+    if (rgb)
+      ready_.push_back({ job.id, job.index, rgb });
+
+    lock.unlock();
+    done_.notify_all();
+
+    awaken();
+  }
+}
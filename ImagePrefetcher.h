@@ -0,0 +1,69 @@
+#ifndef _IMAGEPREFETCHER_H_
+#define _IMAGEPREFETCHER_H_
+
+#include <FL/Fl_Image.H>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Decodes full size images ahead of need on worker threads, so stepping
+// through a selection doesn't wait for each decode. want() replaces the
+// list of images wanted, nearest first; images which are no longer wanted
+// and haven't been started are dropped.
+//
+// Decoded images are handed to the main thread with Fl::awake(), which
+// calls the ready callback; the application must have called Fl::lock()
+// once before Fl::run(). take() gets an image directly, waiting for it
+// if it is being decoded.
+//
+class ImagePrefetcher
+{
+public:
+  struct JOB
+  {
+    unsigned    id;        // ImageModel::id() of the item
+    int         index;     // where the item was, as a hint
+    std::string filename;
+  };
+
+  // Called on the main thread with each decoded image, which it then owns
+  typedef void (*READY)(unsigned id, int index, Fl_RGB_Image *image, void *data);
+
+private:
+  struct DONE
+  {
+    unsigned     id;
+    int          index;
+    Fl_RGB_Image *image;
+  };
+
+  std::vector<std::thread>    threads_;
+  std::mutex                  mutex_;
+  std::condition_variable     wake_;       // work wanted, or stopping
+  std::condition_variable     done_;       // a decode finished
+  std::deque<JOB>             wanted_;     // not started, nearest first
+  std::vector<unsigned>       busy_;       // ids being decoded
+  std::vector<DONE>           ready_;      // decoded, not yet delivered
+  bool                        awakening_;  // Fl::awake() sent, not yet run
+  bool                        stop_;
+
+  READY                       ready_cb_;
+  void                        *ready_data_;
+
+  void run();
+  void awaken();
+  static void awake_cb(void *d);
+
+public:
+  ImagePrefetcher(READY cb, void *data, int threads = 2);
+  ~ImagePrefetcher();
+
+  void          want(std::vector<JOB> &&jobs);
+  Fl_RGB_Image *take(unsigned id);
+  void          deliver();
+};
+
+#endif // _IMAGEPREFETCHER_H_
@@ -0,0 +1,373 @@
+//
+// Header-only image dimension probe.
+//
+// Contents:
+//
+//   probe_jpeg()       - Find the size in a JPEG SOF marker.
+//   probe_tiff()       - Find the size of the largest image in a TIFF.
+//   probe_image_size() - Get the dimensions of an image from its header.
+//   find_exif()        - Find the EXIF data in a JPEG.
+//   exif_date()        - Find the date in EXIF/TIFF IFDs.
+//   probe_image_date() - Get when a photo was taken.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ImageProbe.h"
+
+typedef unsigned char uchar;
+
+static unsigned get16be(const uchar *p) { return (p[0] << 8) | p[1]; }
+static unsigned get32be(const uchar *p) { return ((unsigned)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static unsigned get16le(const uchar *p) { return p[0] | (p[1] << 8); }
+static unsigned get32le(const uchar *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24); }
+
+
+//
+// 'probe_jpeg()' - Find the size in a JPEG SOF marker.
+//
+// Walks the marker segments, seeking over the (possibly large) EXIF and
+// ICC segments without reading them.
+//
+
+static bool
+probe_jpeg(FILE *fp,			// I - File positioned after SOI
+           int  &w,			// O - Width
+           int  &h)			// O - Height
+{
+  uchar	buf[8];				// Segment header
+
+
+  for (;;)
+  {
+    int c = getc(fp);
+
+    if (c == EOF)
+      return false;
+    if (c != 0xff)
+      continue;
+
+    // Markers may be padded with any number of 0xff
+    while ((c = getc(fp)) == 0xff);
+
+    if (c == EOF || c == 0xd9 || c == 0xda) // EOI, SOS: no SOF seen
+      return false;
+    if (c == 0x01 || (c >= 0xd0 && c <= 0xd7)) // no length
+      continue;
+
+    if (fread(buf, 1, 2, fp) != 2)
+      return false;
+
+    unsigned len = get16be(buf);
+    if (len < 2)
+      return false;
+
+    // SOF0-SOF15, except DHT (c4), JPG (c8) and DAC (cc)
+    if (c >= 0xc0 && c <= 0xcf && c != 0xc4 && c != 0xc8 && c != 0xcc)
+    {
+      if (fread(buf, 1, 5, fp) != 5)
+        return false;
+
+      h = get16be(buf + 1);
+      w = get16be(buf + 3);
+      return w > 0 && h > 0;
+    }
+
+    if (fseek(fp, len - 2, SEEK_CUR))
+      return false;
+  }
+}
+
+
+//
+// 'probe_tiff()' - Find the size of the largest image in a TIFF.
+//
+// Raw formats often store a small preview in IFD0 and the real image in
+// a later or sub IFD, so all of them are checked.
+//
+
+static bool
+probe_tiff(FILE *fp,			// I - File
+           bool le,			// I - Little endian?
+           int  &w,			// O - Width
+           int  &h)			// O - Height
+{
+  uchar		buf[12];		// Header/entry buffer
+  unsigned	ifds[16];		// IFD offsets to visit
+  int		numIfds = 0,		// Number of IFDs queued
+		visited = 0;		// Number of IFDs read
+
+
+  if (fseek(fp, 4, SEEK_SET) || fread(buf, 1, 4, fp) != 4)
+    return false;
+
+  ifds[numIfds++] = le ? get32le(buf) : get32be(buf);
+  w = h = 0;
+
+  while (visited < numIfds)
+  {
+    unsigned offset = ifds[visited++];
+
+    if (!offset || fseek(fp, offset, SEEK_SET) || fread(buf, 1, 2, fp) != 2)
+      continue;
+
+    unsigned count = le ? get16le(buf) : get16be(buf);
+    unsigned width = 0, height = 0;
+
+    for (unsigned i = 0; i < count && i < 1000; i++)
+    {
+      if (fread(buf, 1, 12, fp) != 12)
+        break;
+
+      unsigned tag   = le ? get16le(buf) : get16be(buf);
+      unsigned type  = le ? get16le(buf + 2) : get16be(buf + 2);
+      unsigned value = type == 3 ? (le ? get16le(buf + 8) : get16be(buf + 8))
+                                 : (le ? get32le(buf + 8) : get32be(buf + 8));
+
+      if (tag == 256)       // ImageWidth
+        width = value;
+      else if (tag == 257)  // ImageLength
+        height = value;
+      else if (tag == 330 && numIfds < 16) // SubIFDs [first one only]
+      {
+        unsigned n = le ? get32le(buf + 4) : get32be(buf + 4);
+        if (n == 1)
+          ifds[numIfds++] = value;
+        else if (n > 1)
+        {
+          long here = ftell(fp);
+          uchar sub[4];
+          if (!fseek(fp, value, SEEK_SET) && fread(sub, 1, 4, fp) == 4)
+            ifds[numIfds++] = le ? get32le(sub) : get32be(sub);
+          fseek(fp, here, SEEK_SET);
+        }
+      }
+    }
+
+    if ((double)width * height > (double)w * h)
+    {
+      w = width;
+      h = height;
+    }
+
+    // Next IFD in the chain
+    if (numIfds < 16 && fseek(fp, offset + 2 + count * 12, SEEK_SET) == 0 &&
+        fread(buf, 1, 4, fp) == 4)
+      ifds[numIfds++] = le ? get32le(buf) : get32be(buf);
+  }
+
+  return w > 0 && h > 0;
+}
+
+
+//
+// 'probe_image_size()' - Get the dimensions of an image from its header.
+//
+
+bool					// O - true if the size was found
+probe_image_size(
+    const char *filename,		// I - Image file
+    int        &w,			// O - Width
+    int        &h)			// O - Height
+{
+  FILE		*fp;			// Image file
+  uchar		header[26];		// Start of the file
+  bool		found = false;		// Size found?
+
+
+  w = h = 0;
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    return false;
+
+  size_t len = fread(header, 1, sizeof(header), fp);
+
+  if (len >= 3 && header[0] == 0xff && header[1] == 0xd8)
+  {
+    fseek(fp, 2, SEEK_SET);
+    found = probe_jpeg(fp, w, h);
+  }
+  else if (len >= 24 && !memcmp(header, "\211PNG\r\n\032\n", 8) &&
+           !memcmp(header + 12, "IHDR", 4))
+  {
+    w = get32be(header + 16);
+    h = get32be(header + 20);
+    found = w > 0 && h > 0;
+  }
+  else if (len >= 8 && (!memcmp(header, "II*\0", 4) || !memcmp(header, "MM\0*", 4)))
+    found = probe_tiff(fp, header[0] == 'I', w, h);
+  else if (len >= 26 && !memcmp(header, "BM", 2))
+  {
+    if (get32le(header + 14) == 12) // OS/2 BITMAPCOREHEADER
+    {
+      w = get16le(header + 18);
+      h = get16le(header + 20);
+    }
+    else
+    {
+      w = (int)get32le(header + 18);
+      h = (int)get32le(header + 22);
+      if (h < 0) // top-down bitmap
+        h = -h;
+    }
+    found = w > 0 && h > 0;
+  }
+  else if (len >= 10 && (!memcmp(header, "GIF87a", 6) || !memcmp(header, "GIF89a", 6)))
+  {
+    w = get16le(header + 6);
+    h = get16le(header + 8);
+    found = w > 0 && h > 0;
+  }
+
+  fclose(fp);
+
+  if (!found)
+    w = h = 0;
+
+  return found;
+}
+
+
+//
+// 'find_exif()' - Find the EXIF data in a JPEG.
+//
+// EXIF must come right after SOI [possibly after JFIF], so the search
+// gives up at the first segment which isn't an APPn.
+//
+
+static bool				// O - true if found
+find_exif(FILE *fp,			// I - File positioned after SOI
+          long &base)			// O - Offset of the TIFF header
+{
+  uchar	buf[8];				// Segment header
+
+
+  for (;;)
+  {
+    if (fread(buf, 1, 4, fp) != 4 || buf[0] != 0xff || buf[1] < 0xe0 || buf[1] > 0xef)
+      return false;
+
+    unsigned len = get16be(buf + 2);
+    if (len < 2)
+      return false;
+
+    if (buf[1] == 0xe1 && len >= 8 && fread(buf, 1, 6, fp) == 6 &&
+        !memcmp(buf, "Exif\0\0", 6))
+    {
+      base = ftell(fp);
+      return true;
+    }
+
+    if (fseek(fp, buf[1] == 0xe1 && len >= 8 ? (long)len - 8 : (long)len - 2, SEEK_CUR))
+      return false;
+  }
+}
+
+
+//
+// 'exif_date()' - Find the date in EXIF/TIFF IFDs.
+//
+
+static bool				// O - true if found
+exif_date(FILE      *fp,		// I - File
+          long      base,		// I - Offset of the TIFF header
+          long long &date)		// O - YYYYMMDDhhmmss
+{
+  uchar		buf[12];		// Header/entry buffer
+  unsigned	dateTime = 0,		// Offset of DateTime (IFD0)
+		original = 0,		// Offset of DateTimeOriginal
+		exifIfd  = 0;		// Offset of the EXIF IFD
+
+
+  if (fseek(fp, base, SEEK_SET) || fread(buf, 1, 8, fp) != 8 ||
+      (memcmp(buf, "II*\0", 4) && memcmp(buf, "MM\0*", 4)))
+    return false;
+
+  bool     le     = buf[0] == 'I';
+  unsigned offset = le ? get32le(buf + 4) : get32be(buf + 4);
+
+  // IFD0, then the EXIF IFD it points to
+  for (int pass = 0; pass < 2 && offset; pass ++)
+  {
+    if (fseek(fp, base + offset, SEEK_SET) || fread(buf, 1, 2, fp) != 2)
+      break;
+
+    unsigned count = le ? get16le(buf) : get16be(buf);
+
+    for (unsigned i = 0; i < count && i < 1000; i++)
+    {
+      if (fread(buf, 1, 12, fp) != 12)
+        break;
+
+      unsigned tag   = le ? get16le(buf) : get16be(buf);
+      unsigned value = le ? get32le(buf + 8) : get32be(buf + 8);
+
+      if (tag == 0x0132)       // DateTime
+        dateTime = value;
+      else if (tag == 0x8769)  // ExifIFD
+        exifIfd = value;
+      else if (tag == 0x9003)  // DateTimeOriginal
+        original = value;
+    }
+
+    offset  = pass ? 0 : exifIfd;
+  }
+
+  // "YYYY:MM:DD HH:MM:SS"
+  unsigned tries[2] = { original, dateTime };
+
+  for (unsigned at : tries)
+  {
+    char text[20];
+
+    if (!at || fseek(fp, base + at, SEEK_SET) || fread(text, 1, 19, fp) != 19)
+      continue;
+
+    date = 0;
+    for (int i = 0; i < 19; i ++)
+      if (text[i] >= '0' && text[i] <= '9')
+        date = date * 10 + text[i] - '0';
+
+    if (date > 0) // unset dates are all blanks or zeros
+      return true;
+  }
+
+  return false;
+}
+
+
+//
+// 'probe_image_date()' - Get when a photo was taken.
+//
+
+bool					// O - true if the date was found
+probe_image_date(
+    const char *filename,		// I - Image file
+    long long  &date)			// O - YYYYMMDDhhmmss
+{
+  FILE		*fp;			// Image file
+  uchar		header[4];		// Start of the file
+  long		base = 0;		// Offset of the TIFF header
+  bool		found = false;		// Date found?
+
+
+  date = 0;
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    return false;
+
+  size_t len = fread(header, 1, sizeof(header), fp);
+
+  if (len >= 3 && header[0] == 0xff && header[1] == 0xd8)
+  {
+    fseek(fp, 2, SEEK_SET);
+    found = find_exif(fp, base) && exif_date(fp, base, date);
+  }
+  else if (len == 4 && (!memcmp(header, "II*\0", 4) || !memcmp(header, "MM\0*", 4)))
+    found = exif_date(fp, 0, date);
+
+  fclose(fp);
+
+  return found;
+}
@@ -0,0 +1,17 @@
+#ifndef _IMAGEPROBE_H_
+#define _IMAGEPROBE_H_
+
+// Get the dimensions of an image by reading only its header: JPEG SOF,
+// PNG IHDR, TIFF IFD [which includes most camera raw formats], BMP and
+// GIF. Much cheaper than decoding, so layout can be computed before any
+// thumbnail exists. Returns false if the format isn't recognized.
+//
+bool probe_image_size(const char *filename, int &w, int &h);
+
+// Get when a photo was taken from its EXIF DateTimeOriginal [or DateTime],
+// in a JPEG's APP1 segment or a TIFF/raw file's IFDs, as the number
+// YYYYMMDDhhmmss for sorting. Returns false if there is none.
+//
+bool probe_image_date(const char *filename, long long &date);
+
+#endif // _IMAGEPROBE_H_
@@ -1,14 +1,48 @@
 #include <algorithm> // min, max
+#include <atomic>
+#include <ctype.h>
+#include <mutex>
+#include <numeric> // iota
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <FL/Fl_JPEG_Image.H>
+#include <FL/Fl_PNG_Image.H>
+#include <FL/Fl_BMP_Image.H>
+#include <FL/Fl_GIF_Image.H>
+#include <FL/Fl_PNM_Image.H>
+#include <setjmp.h>
+#include <stdio.h>
+#include <jpeglib.h>
 #include "ItemList.h"
-
+#include "ImageCache.h"
+#include "ImageHash.h"
+#include "ImagePrefetcher.h"
+#include "ImageProbe.h"
+#include "PackedImage.h"
+#include "ThumbCache.h"
+#include "ThumbPool.h"
+#include "ThumbWriter.h"
+
+
+// libstdc++'s parallel mode sorts on all cores with OpenMP
+#if defined(_OPENMP) && defined(__GLIBCXX__)
+#  include <parallel/algorithm>
+#  define parallel_sort	__gnu_parallel::sort
+#else
+#  define parallel_sort	std::sort
+#endif // _OPENMP && __GLIBCXX__
 
 #if defined(WIN32) && !defined(__CYGWIN__)
 #  include <direct.h>
 #  include <io.h>
 #  define fl_mkdir(p)	mkdir(p)
 #else
+#  include <signal.h> // kill
 #  include <unistd.h> // access
-#  define fl_mkdir(p)	mkdir(p, 0777)
+#  define fl_mkdir(p)	mkdir(p, 0700) // thumbnails are private
 #endif // WIN32 && !__CYGWIN__
 
 
@@ -46,381 +80,2235 @@ fl_strlcpy(char       *dst,     /* O - Destination string */
 
 
 
+unsigned ItemList::next_id_ = 0;
+
+static XvpicsCache xvpicsCache;
+
+ThumbCache *ItemList::cache_    = &xvpicsCache;
+ThumbCache *ItemList::fallback_ = nullptr;
+bool        ItemList::pack_     = true;
+
+
 ItemList::ItemList()
 {
   items_       = nullptr;
   num_items_   = 0;
   alloc_items_ = 0;
+  arenaLeft_   = 0;
+  writer_      = nullptr;
+
+  images_        = new ImageCache();
+  prefetcher_    = nullptr;
+  prefetchCount_ = 3;
+  shown_         = 0;
+
+  thumbs_      = new ThumbPool();
+  packedBytes_ = 0;
+
+  loader_    = nullptr;
+  tickets_   = 0;
+  readyCb_   = nullptr;
+  readyData_ = nullptr;
+
+  changes_    = 0;
+  indexAt_    = ~0UL;
+  namesAt_    = ~0UL;
 }
 
 ItemList::~ItemList()
 {
+  delete loader_;
+  delete prefetcher_;
+  delete images_;
+  delete thumbs_;
+  delete writer_; // after writing everything queued
+
   if (items_) // TODO unnecessary check?
     delete[] items_;
+
+  free_names();
 }
 
 void ItemList::clear()
 {
-  while (num_items_ > 0)
-    delete_item(0);
+  if (prefetcher_)
+    prefetcher_->want({});
+  if (loader_)
+    loader_->cancel(); // those under way find their items gone
+
+  for (int i = 0; i < num_items_; i ++)
+    free_item(items_[i]);
+
+  images_->clear();
+  thumbs_->clear();
+  shown_ = 0;
+  around_.clear();
+
+  truncate(0);
+  dirty_.clear();
+  free_names();
 }
 
 
 //
-// 'Fl_Image_BrowserV::delete_item()' - Delete an item from the browser.
+// 'ItemList::intern_dir()' - Get the id of a directory name.
 //
 
-void ItemList::delete_item(int i)	// I - Item to delete
+unsigned				// O - Directory id
+ItemList::intern_dir(
+    const char *dir,			// I - Directory name
+    size_t     len)			// I - Length of the name
 {
+  std::string key(dir, len);
+  auto it = dirIds_.find(key);
 
-  if (outOfRange(i))
-    return;
+  if (it != dirIds_.end())
+    return it->second;
 
-  ITEM *item = items_[i];
+  char *copy = new char[len + 1];
+  memcpy(copy, dir, len);
+  copy[len] = '\0';
 
-  if (item->filename)
-    delete[] item->filename;
+  dirs_.push_back(copy);
+  dirIds_[key] = (unsigned)dirs_.size() - 1;
 
-  if (item->thumbname)
-    delete[] item->thumbname;
+  return (unsigned)dirs_.size() - 1;
+}
 
-  if (item->image)
-    item->image->release();
 
-  if (item->thumbnail)
-    item->thumbnail->release();
+//
+// 'ItemList::store_name()' - Copy a name into the name arena.
+//
 
-  if (item->comments)
-    delete[] item->comments;
+#define ARENA_BLOCK 65536
 
-  delete item;
+const char *				// O - Stored copy
+ItemList::store_name(const char *name)	// I - Name
+{
+  size_t len = strlen(name) + 1;
 
-  num_items_ --;
-  if (i < num_items_)
-    memmove(items_ + i, items_ + i + 1, (num_items_ - i) * sizeof(ITEM *));
+  if (len > ARENA_BLOCK / 4)
+  {
+    // Too big to pack; give it a block of its own
+    char *block = new char[len];
+    arena_.insert(arena_.begin(), block); // keep the current block last
+    memcpy(block, name, len);
+    return block;
+  }
+
+  if (len > arenaLeft_)
+  {
+    arena_.push_back(new char[ARENA_BLOCK]);
+    arenaLeft_ = ARENA_BLOCK;
+  }
+
+  char *copy = arena_.back() + ARENA_BLOCK - arenaLeft_;
+  memcpy(copy, name, len);
+  arenaLeft_ -= len;
+
+  return copy;
 }
 
+
 //
-// 'Fl_Image_BrowserV::find()' - Find an item in the browser.
+// 'ItemList::free_names()' - Release all directory and base names.
 //
 
-int					// O - Item number or -1 if none
-ItemList::find(
-    const char *filename)		// I - File to find
+void ItemList::free_names()
 {
-
-    for (int j=0; j < num_items_; j++)
-#if defined(WIN32) || defined(__EMX__) || defined(__APPLE__)
-        if (!strcasecmp(items_[j]->filename, filename))
-            return j;
-#else
-        if (!strcmp(items_[j]->filename, filename))
-            return j;
-#endif // WIN32 || __EMX__ || __APPLE__
-
-    return -1;
+  for (char *dir : dirs_)
+    delete[] dir;
+  for (char *block : arena_)
+    delete[] block;
+
+  dirs_.clear();
+  dirIds_.clear();
+  arena_.clear();
+  arenaLeft_ = 0;
 }
 
+
 //
-// 'Fl_Image_BrowserV::insert_item()' - Insert an item in the browser.
+// 'ItemList::writer()' - Get the thumbnail writer, starting it if needed.
 //
 
-ItemList::ITEM *		// O - New item
-ItemList::insert_item(
-    const char      *f,			// I - Filename
-    Fl_Shared_Image *img,		// I - Image
-    int             i)			// I - Index
+ThumbWriter *
+ItemList::writer()
 {
-  ITEM	*item,				// New item
-	**temp;				// New item array
-  char	thumbdir[512],			// Thumbnail directory
-	thumbname[1024],		// Thumbnail filename
-	*ptr;				// Pointer into filename
+  if (!writer_)
+    writer_ = new ThumbWriter();
 
+  return writer_;
+}
 
-  // Verify that the file exists...
-  if (access(f, 0))
-    return (0);
 
-  // Create a new item...
-  item = new ITEM;
+//
+// 'ItemList::flush()' - Wait for queued thumbnail writes.
+//
 
-  item->filename = new char[strlen(f) + 1];
-  strcpy(item->filename, f);
+void ItemList::flush()
+{
+  if (writer_)
+    writer_->flush();
+}
 
-  // TODO 'label' should be renamed as 'tracker': the label used to lookup the cached thumbnail
-  if ((item->label = strrchr(item->filename, '/')) != NULL)
-    item->label ++;
-  else
-    item->label = item->filename;
-  
-  item->image     = img;
-  item->thumbnail = 0;
-  item->comments  = 0;
-  item->changed   = 0;
-  item->selected  = 0;
 
-  // Load/create the thumbnail image...
-  strlcpy(thumbdir, f, sizeof(thumbdir));
+//
+// 'join_path()' - Put a directory and base name together.
+//
+// The directory is "" for a relative name and "/" for the root.
+//
 
-  if ((ptr = strrchr(thumbdir, '/')) != NULL)
-    ptr ++;
+static void
+join_path(char       *buf,		// O - Filename
+          int        size,		// I - Size of buffer
+          const char *dir,		// I - Directory
+          const char *label)		// I - Base name
+{
+  if (!*dir)
+    strlcpy(buf, label, size);
+  else if (!strcmp(dir, "/"))
+    snprintf(buf, size, "/%s", label);
   else
-    ptr = thumbdir;
+    snprintf(buf, size, "%s/%s", dir, label);
+}
 
-  strlcpy(ptr, ".xvpics", sizeof(thumbdir) - (ptr - thumbdir));
 
-//#ifdef DEBUG
-//  puts(thumbdir);
-//#endif // DEBUG
+//
+// 'ItemList::filename()' - Get the full filename of an item.
+//
 
-  snprintf(thumbname, sizeof(thumbname), "%s/%s", thumbdir, item->label);
+void
+ItemList::filename(int i,		// I - Index
+                   char *buf,		// O - Filename
+                   int  size)		// I - Size of buffer
+{
+  join_path(buf, size, dirs_[items_[i]->dir], items_[i]->label);
+}
 
-  item->thumbname = new char[strlen(thumbname) + 1];
-  strcpy(item->thumbname, thumbname);
 
-#ifdef DEBUG
-  puts(thumbname);
-#endif // DEBUG
+//
+// 'ItemList::index()' - Find the item with an id.
+//
+// The id map is rebuilt on the first lookup after a change.
+//
 
-  if (access(thumbname, 0) ||
-      (item->thumbnail = Fl_Shared_Image::get(thumbname)) == NULL)
+int					// O - Index, -1 if gone
+ItemList::index(unsigned id)		// I - Item id
+{
+  if (indexAt_ != changes_)
   {
-    fl_mkdir(thumbdir);
-    item->save_thumbnail();
+    index_.clear();
+    index_.reserve(num_items_);
+    for (int i = 0; i < num_items_; i ++)
+      index_[items_[i]->id] = i;
+
+    indexAt_ = changes_;
   }
 
-  // Add to the item array...
-  if (i < 0)
-    i = 0;
-  else if (i > num_items_)
-    i = num_items_;
+  auto it = index_.find(id);
 
-  if (num_items_ >= alloc_items_)
-  {
-    temp = new ITEM *[alloc_items_ + 10];
+  return it == index_.end() ? -1 : it->second;
+}
 
-    if (items_)
-    {
-      memcpy(temp, items_, num_items_ * sizeof(ITEM *));
 
-      delete[] items_;
-    }
+//
+// 'Fl_Image_BrowserV::delete_item()' - Delete an item from the browser.
+//
 
-    items_       = temp;
-    alloc_items_ += 10;
-  }
+void ItemList::delete_item(int i)	// I - Item to delete
+{
+
+  if (outOfRange(i))
+    return;
 
+  free_item(items_[i]);
+
+  changes_ ++;
+  num_items_ --;
   if (i < num_items_)
-    memmove(items_ + i + 1, items_ + i, (num_items_ - i) * sizeof(ITEM *));
+    memmove(items_ + i, items_ + i + 1, (num_items_ - i) * sizeof(ITEM *));
 
-  items_[i] = item;
-  num_items_ ++;
+  flags_.erase(flags_.begin() + i);
+  width_.erase(width_.begin() + i);
+  height_.erase(height_.begin() + i);
+}
 
-  return (item);
+//
+// 'ItemList::free_item()' - Release an item and its images.
+//
+void ItemList::free_item(ITEM *item)	// I - Item to free
+{
+
+  images_->remove(item->id);
+  thumbs_->remove(item->id);
+  destroy_item(item);
 }
 
 //
-// 'Fl_Image_BrowserV::load_item()' - Load the image for an item.
+// 'ItemList::destroy_item()' - Free an item's memory.
 //
 
-Fl_Shared_Image *			// O - Image
-ItemList::load_item(int i)	// I - Index
+void ItemList::destroy_item(ITEM *item)	// I - Item to free
 {
+  if (item->packed)
+  {
+    packedBytes_ -= item->packed->bytes();
+    delete item->packed;
+  }
 
-  if (outOfRange(i))
-    return nullptr;
+  if (item->thumbnail)
+    item->thumbnail->release();
 
-  ITEM *item = items_[i];
+  if (item->comments)
+    delete[] item->comments;
 
-  if (!item->image)
-    item->image = Fl_Shared_Image::get(item->filename);
+  delete item;
+}
+
+//
+// 'ItemList::shift_item()' - Move an item's entries down while compacting.
+//
 
-  return item->image;
+void ItemList::shift_item(int from,	// I - Old index
+                          int to)	// I - New index, <= from
+{
+  items_[to]  = items_[from];
+  flags_[to]  = flags_[from];
+  width_[to]  = width_[from];
+  height_[to] = height_[from];
 }
 
 //
-// 'Fl_Image_BrowserV::move_item()' - Move an image in the browser.
+// 'ItemList::truncate()' - Drop the entries past the first n items.
 //
 
-void
-ItemList::move_item(int from,	// I - From item
-                            int to)	// I - To item
+void ItemList::truncate(int n)		// I - Items to keep
 {
+  changes_ ++;
+  num_items_ = n;
+  flags_.resize(n);
+  width_.resize(n);
+  height_.resize(n);
+}
 
-#ifdef DEBUG
-  printf("ItemList::move_item(from=%d, to=%d)\n", from, to);
-#endif // DEBUG
+//
+// 'ItemList::remove()' - Delete several items.
+//
+// The survivors keep their order. Out of range and repeated indices are
+// ignored.
+//
 
-  if (outOfRange(from) || outOfRange(to) || from == to)
-    return;
+int					// O - Number of items deleted
+ItemList::remove(const std::vector<int> &indices)	// I - Items to delete
+{
+  std::vector<char> doomed(num_items_, 0);
+  int		    j = 0;		// Next free slot
 
-#ifdef DEBUG
-  printf("    num_items_=%d\n", num_items_);
-#endif // DEBUG
 
-  ITEM *temp = items_[from];
+  for (int i : indices)
+    if (!outOfRange(i))
+      doomed[i] = 1;
 
-  if (to < from)
-    memmove(items_ + to + 1, items_ + to, (from - to) * sizeof(ITEM *));
-  else
-  {
-    memmove(items_ + from, items_ + from + 1, (to - from) * sizeof(ITEM *));
+  for (int i = 0; i < num_items_; i ++)
+    if (doomed[i])
+      free_item(items_[i]);
+    else
+      shift_item(i, j ++);
 
-    to --;
-  }
+  int removed = num_items_ - j;
 
-  items_[to] = temp;
-}
+  truncate(j);
+  if (removed)
+    dirty_.clear();
 
-void ItemList::clearSelect()
-{
-    for (int i = 0; i < num_items_; i ++)
-        items_[i]->selected = 0;
+  return (removed);
 }
 
-void ItemList::forceSelect(int i)
-{
-    items_[i]->selected = 1;
-}
+//
+// 'ItemList::remove_selected()' - Delete the selected items.
+//
 
-void ItemList::select(int i)
+int					// O - Number of items deleted
+ItemList::remove_selected()
 {
-  if (outOfRange(i))
-    return;
+  int j = 0;				// Next free slot
 
-  // select only the specified, clear all others
-  for (int j = 0; j < num_items_; j ++)
-    items_[j]->selected = j == i;
-}
 
-void ItemList::selectRange(int from, int to)
-{
-    for (int i = std::min(from, to); i <= std::max(from, to); i++)
-        items_[i]->selected = 1;
-}
+  for (int i = 0; i < num_items_; i ++)
+    if (flags_[i] & SELECTED)
+      free_item(items_[i]);
+    else
+      shift_item(i, j ++);
 
-void ItemList::toggleSelect(int sel)
-{
-    if (outOfRange(sel))
-        return;
-    items_[sel]->selected = !items_[sel]->selected;
+  int removed = num_items_ - j;
+
+  truncate(j);
+  if (removed)
+    dirty_.clear();
+
+  return (removed);
 }
 
-bool ItemList::isSelected(int idx)
+//
+// 'ItemList::move_selected()' - Move the selected items together.
+//
+// The selected items keep their order and end up just before item 'to',
+// which is an index before the move; 'to' of count() moves them to the
+// end. A selected 'to' stands for the next unselected item.
+//
+
+int					// O - New index of the first moved item,
+					//     -1 if nothing is selected
+ItemList::move_selected(int to)		// I - Item to move in front of
 {
-    return outOfRange(idx) ? false : items_[idx]->selected;
-}
+  std::vector<int> moved, rest;		// Old indices
+  int		   at = 0;		// Index of the moved block
+
 
+  moved.reserve(num_items_);
+  rest.reserve(num_items_);
+
+  for (int i = 0; i < num_items_; i ++)
+    if (flags_[i] & SELECTED)
+      moved.push_back(i);
+    else
+    {
+      rest.push_back(i);
+      if (i < to)
+        at ++;
+    }
+
+  if (moved.empty())
+    return (-1);
+
+  // New order, as old indices
+  std::vector<int> order(rest.begin(), rest.begin() + at);
+  order.insert(order.end(), moved.begin(), moved.end());
+  order.insert(order.end(), rest.begin() + at, rest.end());
+
+  reorder(order);
+
+  return (at);
+}
 
 //
-// 'Fl_Image_BrowserV::ITEM::make_thumbnail()' - Make the thumbnail image.
+// 'ItemList::reorder()' - Put all items in a new order.
 //
 
-// TODO what if image is smaller than THUMBSIZE?
-// KBR create a decent sized thumbnail in the first place
-//#define THUMBSIZE (ITEMWIDTH-20)
-#define THUMBSIZE 500
-
 void
-ItemList::ITEM::make_thumbnail()
+ItemList::reorder(
+    const std::vector<int> &order)	// I - Old index of each new position
 {
+  std::vector<ITEM *>        items(num_items_);
+  std::vector<unsigned char> flags(num_items_);
+  std::vector<int>           width(num_items_), height(num_items_);
 
-  // Clear the thumbnail image as needed...
-  if (thumbnail)
+
+  for (int i = 0; i < num_items_; i ++)
   {
-    thumbnail->release();
-    thumbnail = nullptr;
+    items[i]  = items_[order[i]];
+    flags[i]  = flags_[order[i]];
+    width[i]  = width_[order[i]];
+    height[i] = height_[order[i]];
   }
 
-  // Create the thumbnail image...
-  bool releaseit = false; // need to release the image?
-  if (!image)
+  std::copy(items.begin(), items.end(), items_);
+  changes_ ++;
+  flags_.swap(flags);
+  width_.swap(width);
+  height_.swap(height);
+
+  dirty_.clear();
+}
+
+//
+// 'ItemList::sort()' - Sort the items.
+//
+
+int					// O - New index of anchor, or -1
+ItemList::sort(SORT by,			// I - Key
+               bool descending,		// I - Largest first?
+               int  anchor)		// I - Item to follow
+{
+  int                    n = num_items_;
+  std::vector<long long> key;		// Numeric keys
+  std::vector<int>       order(n);	// Old index of each new position
+
+
+  if (by != BY_NAME && by != BY_NATURAL)
   {
-    releaseit = true;
-    image     = Fl_Shared_Image::get(filename);
+    key.resize(n);
+
+    // Mostly file system and header reads: dynamic, as some are slow
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < n; i ++)
+    {
+      ITEM        *item = items_[i];
+      char        filename[1024];	// Image filename
+      struct stat fileinfo;		// File information
+      int         w, h;			// Probed size
+
+
+      this->filename(i, filename, sizeof(filename));
+
+      switch (by)
+      {
+        case BY_MTIME :
+        case BY_SIZE :
+          if (!item->mtime && !stat(filename, &fileinfo))
+            key[i] = by == BY_MTIME ? (long long)fileinfo.st_mtime : (long long)fileinfo.st_size;
+          else
+            key[i] = by == BY_MTIME ? (long long)item->mtime : (long long)item->size;
+          break;
+
+        case BY_DIMENSIONS :
+          if ((!width_[i] || !height_[i]) && probe_image_size(filename, w, h))
+            setSize(i, w, h);
+          key[i] = (long long)width_[i] * height_[i];
+          break;
+
+        default : // BY_DATE
+          if (!probe_image_date(filename, key[i]))
+          {
+            // The file time, in the same YYYYMMDDhhmmss form
+            time_t    mtime = item->mtime;
+            struct tm tm;
+
+            if (!mtime && !stat(filename, &fileinfo))
+              mtime = fileinfo.st_mtime;
+
+            if (mtime && localtime_r(&mtime, &tm))
+              key[i] = (tm.tm_year + 1900) * 10000000000LL +
+                       (tm.tm_mon + 1) * 100000000LL + tm.tm_mday * 1000000LL +
+                       tm.tm_hour * 10000 + tm.tm_min * 100 + tm.tm_sec;
+          }
+          break;
+      }
+    }
   }
 
-  if (image && image->w() && image->h())
+  std::iota(order.begin(), order.end(), 0);
+
+  auto compare = [&](int a, int b)
   {
-    // Size the thumbnail within an 80x80 box...
-    int W = THUMBSIZE;
-    int H = W * image->h() / image->w();
+    int c;
 
-    if (image->h() > image->w()) //(H > THUMBSIZE)
+    if (by == BY_NAME || by == BY_NATURAL)
     {
-      H = THUMBSIZE;
-      W = H * image->w() / image->h();
+      c = by == BY_NAME ? strcmp(items_[a]->label, items_[b]->label)
+                        : natural_compare(items_[a]->label, items_[b]->label);
+      if (!c && items_[a]->dir != items_[b]->dir)
+        c = strcmp(dirname(a), dirname(b));
     }
+    else
+      c = key[a] < key[b] ? -1 : key[a] > key[b];
 
-    thumbnail = (Fl_Shared_Image *)image->copy(W, H);
-    
-  }
+    return c ? (descending ? c > 0 : c < 0) : a < b;
+  };
 
-  if (image && releaseit)
-  {
-    image->release();
-    image = 0;
-  }
-}
+  parallel_sort(order.begin(), order.end(), compare);
+
+  reorder(order);
 
+  if (outOfRange(anchor))
+    return (-1);
+
+  return (int)(std::find(order.begin(), order.end(), anchor) - order.begin());
+}
 
 //
-// 'Fl_Image_BrowserV::ITEM::save_thumbnail()' - Save the thumbnail image.
+// 'ItemList::duplicates()' - Find groups of near-duplicate items.
+//
+// Thumbnails still to be loaded or made are left to the workers, rather
+// than held up for here; those the widget cancels meanwhile [see
+// cancelFetch()] are asked for again by the next call.
 //
 
-void
-ItemList::ITEM::save_thumbnail(
-    int createit)			// I - 1 = create thumbnail image
+std::vector<std::vector<int> >		// O - Groups of item indices
+ItemList::duplicates(int maxDistance,	// I - Most differing hash bits
+                     int *pending)	// O - Items still being hashed, or NULL
 {
-  FILE		*thumbfile;		// Thumbnail file
-
-
-  // Create the thumbnail image as needed...
-  if (createit || !thumbnail)
-    make_thumbnail();
+  int waiting = 0;			// Items still being hashed
 
-  if (!thumbnail)
-    return;
 
-  int W = thumbnail->w();
-  int H = thumbnail->h();
-  int D = thumbnail->d();
-  
-  // Save the thumbnail image...
-  if ((thumbfile = fopen(thumbname, "wb")) != NULL)
+  // Hashes stored with cached thumbnails, without loading the images
+#pragma omp parallel for schedule(dynamic, 64)
+  for (int i = 0; i < num_items_; i ++)
   {
-    fprintf(thumbfile, "P7 332\n%d %d 255\n", W, H);
+    ITEM     *item = items_[i];
+    char     filename[1024],		// Image filename
+             thumbname[1024];		// Thumbnail filename
+    uint64_t hash;
 
-    // ptr to image data
-    uchar *rgb = (uchar *)thumbnail->data()[0];
-    for (int Y = 0; Y < H; Y ++)
-      for (int X = 0; X < W; X ++)
-      {
-        int r = *rgb++ >> 5;
-        int g = *rgb++ >> 5;
-        int b = *rgb++ >> 6;
-
-        putc((((r << 3) | g) << 2) | b, thumbfile);
-        
-        if (D == 4)
-            rgb++;
-      }
 
-    fclose(thumbfile);
-  }
-}
+    if (item->hashed)
+      continue;
 
-int ItemList::find(int x, int y)
-{
-    for (int i=0; i < count(); i++)
+    this->filename(i, filename, sizeof(filename));
+    if (find_thumbnail(filename, thumbname, sizeof(thumbname)) &&
+        thumb_hash(thumbname, hash))
     {
-        ITEM *tem = items_[i];
-        if (x < tem->_x || y < tem->_y)
-            continue;
-        if (x < (tem->_x + tem->_w) &&
-            y < (tem->_y + tem->_h))
-            return i;
+      item->dhash  = hash;
+      item->hashed = true;
     }
-    return -1;
+  }
+
+  // The rest need their thumbnail
+  std::vector<uint64_t> hashes;
+  std::vector<int>      index;		// Item of each hash
+
+  for (int i = 0; i < num_items_; i ++)
+  {
+    if (!items_[i]->hashed)
+    {
+      fetch(i);
+
+      if (items_[i]->ticket)
+        waiting ++;
+    }
+
+    if (items_[i]->hashed)
+    {
+      hashes.push_back(items_[i]->dhash);
+      index.push_back(i);
+    }
+  }
+
+  if (pending)
+    *pending = waiting;
+
+  std::vector<std::vector<int> > groups = hash_clusters(hashes, maxDistance);
+
+  for (auto &group : groups)
+    for (int &member : group)
+      member = index[member];
+
+  return groups;
+}
+
+//
+// 'ItemList::natural_compare()' - Compare names with numbers in them.
+//
+// Runs of digits compare by value [leading zeros don't count], other
+// characters without regard to case. Names which only differ in case or
+// leading zeros fall back to strcmp().
+//
+
+int					// O - <0, 0 or >0 as for strcmp()
+ItemList::natural_compare(const char *a,	// I - First name
+                          const char *b)	// I - Second name
+{
+  const char *s = a, *t = b;
+
+
+  while (*s && *t)
+  {
+    if (isdigit((unsigned char)*s) && isdigit((unsigned char)*t))
+    {
+      while (*s == '0')
+        s ++;
+      while (*t == '0')
+        t ++;
+
+      const char *ds = s, *dt = t;	// Start of the significant digits
+
+      while (isdigit((unsigned char)*s))
+        s ++;
+      while (isdigit((unsigned char)*t))
+        t ++;
+
+      // More significant digits is bigger; else the first difference
+      if (s - ds != t - dt)
+        return (int)((s - ds) - (t - dt));
+
+      for (; ds < s; ds ++, dt ++)
+        if (*ds != *dt)
+          return *ds - *dt;
+    }
+    else
+    {
+      int c = tolower((unsigned char)*s) - tolower((unsigned char)*t);
+
+      if (c)
+        return c;
+
+      s ++;
+      t ++;
+    }
+  }
+
+  if (*s || *t)
+    return *s ? 1 : -1;
+
+  return strcmp(a, b);
+}
+
+//
+// 'ItemList::name_key()' - Get the key of a filename for find().
+//
+
+std::string				// O - Key
+ItemList::name_key(const char *filename)	// I - Filename
+{
+  std::string key(filename);
+
+#if defined(WIN32) || defined(__EMX__) || defined(__APPLE__)
+  for (char &c : key)
+    c = (char)tolower((unsigned char)c);
+#endif // WIN32 || __EMX__ || __APPLE__
+
+  return key;
+}
+
+//
+// 'Fl_Image_BrowserV::find()' - Find an item in the browser.
+//
+// The filename map is rebuilt on the first lookup after a change other
+// than appending, so checking a whole directory against the list is
+// linear rather than a scan per file.
+//
+
+int					// O - Item number or -1 if none
+ItemList::find(
+    const char *filename)		// I - File to find
+{
+  if (namesAt_ != changes_)
+  {
+    char name[1024];			// Item filename
+
+    names_.clear();
+    names_.reserve(num_items_);
+    for (int i = 0; i < num_items_; i ++)
+    {
+      this->filename(i, name, sizeof(name));
+      names_.emplace(name_key(name), i); // the first of any duplicates
+    }
+
+    namesAt_ = changes_;
+  }
+
+  auto it = names_.find(name_key(filename));
+
+  return it == names_.end() ? -1 : it->second;
+}
+
+//
+// 'ItemList::new_item()' - Create an item without a thumbnail.
+//
+
+ItemList::ITEM *		// O - New item
+ItemList::new_item(
+    const char      *f,			// I - Filename
+    Fl_Shared_Image *img)		// I - Image
+{
+  ITEM		*item;			// New item
+  const char	*slash;			// End of the directory part
+
+
+  // Create a new item...
+  item = new ITEM;
+
+  // TODO 'label' should be renamed as 'tracker': the label used to lookup the cached thumbnail
+  if ((slash = strrchr(f, '/')) != NULL)
+  {
+    // "/name" is in the root directory, not a relative name
+    item->dir   = intern_dir(f, slash > f ? slash - f : 1);
+    item->label = store_name(slash + 1);
+  }
+  else
+  {
+    item->dir   = intern_dir("", 0);
+    item->label = store_name(f);
+  }
+  
+  if (img)
+    images_->add(item->id, img);
+
+  item->thumbnail  = 0;
+  item->packed     = 0;
+  item->comments   = 0;
+  item->loaded     = 0;
+  item->ticket     = 0;
+  item->previewed  = false;
+  item->unthreaded = false;
+  item->hashed     = false;
+  item->dhash      = 0;
+  item->mtime      = 0;
+  item->size       = 0;
+  item->id         = ++next_id_;
+
+  return (item);
+}
+
+//
+// 'ItemList::add_to_array()' - Put an item in the item array.
+//
+
+void
+ItemList::add_to_array(
+    ITEM *item,				// I - Item
+    int  i,				// I - Index
+    int  width,				// I - Image width
+    int  height)			// I - Image height
+{
+  // Add to the item array...
+  if (i < 0)
+    i = 0;
+  else if (i > num_items_)
+    i = num_items_;
+
+  if (num_items_ >= alloc_items_)
+    reserve(alloc_items_ < 10 ? 10 : alloc_items_ * 2);
+
+  if (i < num_items_)
+    memmove(items_ + i + 1, items_ + i, (num_items_ - i) * sizeof(ITEM *));
+
+  items_[i] = item;
+  num_items_ ++;
+
+  // Appending moves no other item: the lookups stay current
+  bool indexed = indexAt_ == changes_ && i == num_items_ - 1;
+  bool named   = namesAt_ == changes_ && i == num_items_ - 1;
+
+  changes_ ++;
+
+  if (indexed)
+  {
+    index_[item->id] = i;
+    indexAt_         = changes_;
+  }
+
+  if (named)
+  {
+    char name[1024];			// Item filename
+
+    filename(i, name, sizeof(name));
+    names_.emplace(name_key(name), i);
+    namesAt_ = changes_;
+  }
+
+  flags_.insert(flags_.begin() + i, 0);
+  width_.insert(width_.begin() + i, width);
+  height_.insert(height_.begin() + i, height);
+}
+
+//
+// 'ItemList::reserve()' - Make room for a number of items.
+//
+
+void
+ItemList::reserve(int n)		// I - Number of items
+{
+  ITEM	**temp;				// New item array
+
+
+  if (n <= alloc_items_)
+    return;
+
+  temp = new ITEM *[n];
+
+  if (items_)
+  {
+    memcpy(temp, items_, num_items_ * sizeof(ITEM *));
+
+    delete[] items_;
+  }
+
+  items_       = temp;
+  alloc_items_ = n;
+
+  flags_.reserve(n);
+  width_.reserve(n);
+  height_.reserve(n);
+}
+
+//
+// 'Fl_Image_BrowserV::insert_item()' - Insert an item in the browser.
+//
+
+ItemList::ITEM *		// O - New item
+ItemList::insert_item(
+    const char      *f,			// I - Filename
+    Fl_Shared_Image *img,		// I - Image
+    int             i)			// I - Index
+{
+  ITEM		*item;			// New item
+  struct stat	fileinfo;		// Information about file
+  int		width = 0,		// Image size
+		height = 0;
+
+
+  // Verify that the file exists...
+  if (stat(f, &fileinfo))
+    return (0);
+
+  item = new_item(f, img);
+  item->mtime = fileinfo.st_mtime;
+  item->size  = fileinfo.st_size;
+
+  // Layout needs the image size before there is any thumbnail
+  if (img && img->w() && img->h())
+  {
+    width  = img->w();
+    height = img->h();
+  }
+  else
+    probe_image_size(f, width, height);
+
+  // Load/create the thumbnail image...
+  item->load_thumbnail(f, writer());
+  pack(item);
+
+  add_to_array(item, i, width, height);
+
+  return (item);
+}
+
+//
+// 'ItemList::add_item()' - Append an item whose details are already known.
+//
+// Nothing is read from disk; the thumbnail is loaded on demand by
+// load_thumbnail().
+//
+
+ItemList::ITEM *		// O - New item
+ItemList::add_item(
+    const char *f,			// I - Filename
+    int        width,			// I - Image width
+    int        height,			// I - Image height
+    time_t     mtime,			// I - Modification time
+    off_t      size)			// I - File size
+{
+  ITEM	*item = new_item(f, nullptr);	// New item
+
+  item->mtime  = mtime;
+  item->size   = size;
+
+  add_to_array(item, num_items_, width, height);
+
+  return (item);
+}
+
+//
+// 'ItemList::refresh()' - Take note of an item's file having changed.
+//
+// The full image of the old contents is dropped [an image load_item()
+// returned for it is no longer valid], and the thumbnail is remade on
+// the next fetch(), rather than from that image.
+//
+
+void
+ItemList::refresh(int    i,		// I - Index
+                  time_t mtime,		// I - New modification time
+                  off_t  size,		// I - New file size
+                  int    width,		// I - New image width, 0 if unknown
+                  int    height)	// I - New image height
+{
+  ITEM *item = items_[i];
+
+  images_->remove(item->id);
+
+  item->mtime      = mtime;
+  item->size       = size;
+  item->loaded     = 0;
+  item->ticket     = 0;  // a worker's copy may be of the old contents
+  item->hashed     = false;
+  item->unthreaded = false;
+
+  setSize(i, width, height);
+}
+
+//
+// 'ItemList::load_thumbnail()' - Load or create the thumbnail for an item.
+//
+
+bool					// O - true if the item has a thumbnail
+ItemList::load_thumbnail(int i)		// I - Index
+{
+
+  if (outOfRange(i))
+    return false;
+
+  // A worker's copy under way is dropped when it comes in
+  if (!items_[i]->loaded || items_[i]->ticket)
+  {
+    char filename[1024];		// Image filename
+
+    this->filename(i, filename, sizeof(filename));
+    items_[i]->ticket = 0;
+    items_[i]->load_thumbnail(filename, writer(), images_->peek(items_[i]->id));
+    pack(items_[i]);
+  }
+
+  return items_[i]->packed || items_[i]->thumbnail;
+}
+
+
+//
+// 'ItemList::pack()' - Keep an item's new thumbnail packed.
+//
+// Whatever was packed before [a preview] goes. 'packed' is a thumbnail a
+// worker has packed already; otherwise the item's thumbnail is packed.
+// Images without pixel data are kept as they are, and so is every
+// thumbnail when packing is off [see pack_thumbnails()].
+//
+
+void
+ItemList::pack(ITEM        *item,	// I - Item
+               PackedImage *packed)	// I - Packed thumbnail, or NULL
+{
+  thumbs_->remove(item->id);
+
+  if (item->packed)
+  {
+    packedBytes_ -= item->packed->bytes();
+    delete item->packed;
+    item->packed = nullptr;
+  }
+
+  if (!packed && item->thumbnail && pack_)
+  {
+    packed = new PackedImage(item->thumbnail);
+
+    if (!packed->w())
+    {
+      delete packed;
+      return;
+    }
+  }
+
+  if (!packed)
+    return;
+
+  if (item->thumbnail)
+  {
+    item->thumbnail->release();
+    item->thumbnail = nullptr;
+  }
+
+  item->packed  = packed;
+  packedBytes_ += packed->bytes();
+}
+
+
+//
+// 'ItemList::fetch()' - Have a worker load or make an item's thumbnail.
+//
+// One made from a full image already loaded is quick, and made here; so
+// is one a worker couldn't make [see thumb_ready()].
+//
+
+void
+ItemList::fetch(int i)			// I - Index
+{
+  ITEM *item = items_[i];
+  char filename[1024];			// Image filename
+
+
+  if (item->loaded)
+    return;
+
+  if (images_->peek(item->id) || item->unthreaded)
+  {
+    load_thumbnail(i);
+    return;
+  }
+
+  // Half the cores: the rest are for drawing, and the prefetcher
+  if (!loader_)
+    loader_ = new ThumbLoader(thumb_ready, this,
+                              std::max(2, (int)std::thread::hardware_concurrency() / 2));
+
+  this->filename(i, filename, sizeof(filename));
+
+  item->loaded = 1;
+  item->ticket = ++ tickets_;
+  loader_->add({ item->id, item->ticket, filename, pack_ });
+}
+
+
+//
+// 'ItemList::cancelFetch()' - Drop the fetches not started yet.
+//
+
+void
+ItemList::cancelFetch()
+{
+  if (!loader_)
+    return;
+
+  for (unsigned id : loader_->cancel())
+  {
+    int i = index(id);
+
+    if (i >= 0)
+    {
+      items_[i]->loaded = 0;
+      items_[i]->ticket = 0;
+    }
+  }
+}
+
+
+//
+// 'ItemList::thumb_ready()' - Keep a thumbnail a worker has loaded or made.
+//
+// One the worker couldn't make, which needs Fl_Shared_Image [see
+// decode_image()], is left for fetch() to make on the main thread; the
+// widget asks for it again at idle time, when it is next wanted.
+//
+
+void
+ItemList::thumb_ready(
+    ThumbLoader::RESULT &result,	// I - Thumbnail
+    void                *d)		// I - ItemList
+{
+  ItemList *list = (ItemList *)d;
+  int      i     = list->index(result.id);
+
+
+  // Gone, loaded since, or asked for again
+  if (i < 0 || list->items_[i]->ticket != result.ticket)
+  {
+    delete result.packed;
+    delete result.image;
+    return;
+  }
+
+  ITEM *item = list->items_[i];
+
+  if (result.packed || result.image)
+  {
+    item->ticket = 0;
+    item->hashed = result.hashed;
+    item->dhash  = result.dhash;
+
+    if (result.image)
+    {
+      if (item->thumbnail)
+        item->thumbnail->release(); // the preview
+      item->thumbnail = Fl_Shared_Image::get(result.image);
+    }
+
+    list->pack(item, result.packed);
+  }
+  else
+  {
+    item->loaded     = 0;
+    item->ticket     = 0;
+    item->unthreaded = true;
+  }
+
+  if (list->readyCb_)
+    (*list->readyCb_)(i, list->readyData_);
+}
+
+
+//
+// 'ItemList::thumbnail()' - Get an item's thumbnail to draw.
+//
+// Packed thumbnails are unpacked into the pool, which keeps those drawn
+// most recently.
+//
+
+Fl_Image *				// O - Thumbnail or NULL
+ItemList::thumbnail(int i)		// I - Index
+{
+  ITEM *item = items_[i];
+
+  return item->packed ? thumbs_->get(item->id, item->packed) : item->thumbnail;
+}
+
+
+//
+// 'ItemList::thumbnailKey()' - Get what stands for an item's thumbnail.
+//
+// The packed thumbnail, not the pool's unpacked copy, which comes and
+// goes with the pool.
+//
+
+const void *				// O - Key or NULL
+ItemList::thumbnailKey(int i)		// I - Index
+{
+  ITEM *item = items_[i];
+
+  return item->packed ? (const void *)item->packed : (const void *)item->thumbnail;
+}
+
+
+//
+// 'ItemList::keepThumbnails()' - Keep the thumbnails handed out for now.
+//
+
+void
+ItemList::keepThumbnails(bool keep)	// I - Start or stop keeping
+{
+  thumbs_->keep(keep);
+}
+
+
+//
+// 'ItemList::keepBytes()' - Get how many bytes of kept thumbnails are fine.
+//
+// Those the pool holds anyway.
+//
+
+size_t					// O - Bytes
+ItemList::keepBytes()
+{
+  return thumbs_->maxBytes();
+}
+
+//
+// 'Fl_Image_BrowserV::load_item()' - Load the image for an item.
+//
+// Usually a prefetched image is already there, or nearly done. The image
+// is the cache's, and stays loaded until another item is loaded or
+// prefetched around.
+//
+
+Fl_Shared_Image *			// O - Image
+ItemList::load_item(int i)	// I - Index
+{
+
+  if (outOfRange(i))
+    return nullptr;
+
+  ITEM *item = items_[i];
+
+  // Pinned first, so the image isn't evicted as soon as it is added
+  shown_ = item->id;
+  pin_images();
+
+  Fl_Shared_Image *image = images_->find(item->id);
+
+  if (!image)
+  {
+    // Decoded ahead (or being decoded) by the prefetcher?
+    Fl_RGB_Image *rgb = prefetcher_ ? prefetcher_->take(item->id) : nullptr;
+
+    if (rgb)
+      image = Fl_Shared_Image::get(rgb);
+    else
+    {
+      char filename[1024];		// Image filename
+
+      this->filename(i, filename, sizeof(filename));
+      image = Fl_Shared_Image::get(filename);
+    }
+
+    if (image)
+      images_->add(item->id, image);
+  }
+
+  return image;
+}
+
+//
+// 'ItemList::pin_images()' - Keep the shown and prefetched images cached.
+//
+
+void ItemList::pin_images()
+{
+  std::vector<unsigned> ids(around_);
+
+  if (shown_)
+    ids.push_back(shown_);
+
+  images_->pin(ids);
+}
+
+//
+// 'ItemList::prefetch()' - Decode the full images around an item.
+//
+// Those ahead in the direction of travel come first, then those behind;
+// standing still, both sides alternate. Their images are pinned in the
+// cache until the next prefetch().
+//
+
+void
+ItemList::prefetch(int i,		// I - Item being viewed
+                   int direction)	// I - -1, 0 or 1
+{
+
+  if (outOfRange(i) || prefetchCount_ <= 0)
+    return;
+
+  if (!prefetcher_)
+    prefetcher_ = new ImagePrefetcher(image_ready, this);
+
+  int step = direction < 0 ? -1 : 1;
+  std::vector<int> order;		// Items, nearest first
+
+  order.push_back(i);
+  for (int n = 1; n <= prefetchCount_; n ++)
+  {
+    if (direction)
+      order.insert(order.begin() + n, i + n * step);
+    else
+      order.push_back(i + n);
+    order.push_back(i - n * step);
+  }
+
+  std::vector<ImagePrefetcher::JOB> jobs;
+
+  around_.clear();
+
+  for (int j : order)
+  {
+    if (outOfRange(j))
+      continue;
+
+    around_.push_back(items_[j]->id);
+
+    if (images_->peek(items_[j]->id))
+      continue;
+
+    char filename[1024];		// Image filename
+
+    this->filename(j, filename, sizeof(filename));
+    jobs.push_back({ items_[j]->id, j, filename });
+  }
+
+  // Let go of [the pins on] those we have moved away from
+  pin_images();
+
+  prefetcher_->want(std::move(jobs));
+}
+
+//
+// 'ItemList::image_ready()' - Keep an image decoded by the prefetcher.
+//
+
+void
+ItemList::image_ready(
+    unsigned     id,			// I - Item id
+    int          index,			// I - Where the item was
+    Fl_RGB_Image *image,		// I - Decoded image
+    void         *d)			// I - ItemList
+{
+  ItemList *list = (ItemList *)d;
+
+
+  // Items may have moved, or gone, since the image was asked for
+  if (list->outOfRange(index) || list->items_[index]->id != id)
+    index = list->index(id);
+
+  if (list->outOfRange(index))
+  {
+    delete image;
+    return;
+  }
+
+  list->images_->add(id, Fl_Shared_Image::get(image));
+}
+
+//
+// 'Fl_Image_BrowserV::move_item()' - Move an image in the browser.
+//
+
+void
+ItemList::move_item(int from,	// I - From item
+                            int to)	// I - To item
+{
+
+#ifdef DEBUG
+  printf("ItemList::move_item(from=%d, to=%d)\n", from, to);
+#endif // DEBUG
+
+  if (outOfRange(from) || outOfRange(to) || from == to)
+    return;
+
+#ifdef DEBUG
+  printf("    num_items_=%d\n", num_items_);
+#endif // DEBUG
+
+  ITEM *temp = items_[from];
+
+  if (to < from)
+    memmove(items_ + to + 1, items_ + to, (from - to) * sizeof(ITEM *));
+  else
+  {
+    memmove(items_ + from, items_ + from + 1, (to - from) * sizeof(ITEM *));
+
+    to --;
+  }
+
+  items_[to] = temp;
+  changes_ ++;
+
+  // The same move for the hot arrays ('to' is now the item's new index)
+  int first = std::min(from, to), last = std::max(from, to) + 1;
+  int mid   = to < from ? from : from + 1;
+
+  std::rotate(flags_.begin() + first, flags_.begin() + mid, flags_.begin() + last);
+  std::rotate(width_.begin() + first, width_.begin() + mid, width_.begin() + last);
+  std::rotate(height_.begin() + first, height_.begin() + mid, height_.begin() + last);
+}
+
+// Selection changes note which items need repainting, so a click or
+// arrow key only redraws the tiles involved.
+
+void ItemList::clearSelect()
+{
+    for (int i = 0; i < num_items_; i ++)
+        if (flags_[i] & SELECTED)
+        {
+            flags_[i] &= ~SELECTED;
+            dirty_.push_back(i);
+        }
+}
+
+void ItemList::forceSelect(int i)
+{
+    if (!(flags_[i] & SELECTED))
+        dirty_.push_back(i);
+    flags_[i] |= SELECTED;
+}
+
+void ItemList::select(int i)
+{
+  if (outOfRange(i))
+    return;
+
+  // select only the specified, clear all others
+  for (int j = 0; j < num_items_; j ++)
+    if (((flags_[j] & SELECTED) != 0) != (j == i))
+    {
+      flags_[j] ^= SELECTED;
+      dirty_.push_back(j);
+    }
+}
+
+void ItemList::selectRange(int from, int to)
+{
+    for (int i = std::min(from, to); i <= std::max(from, to); i++)
+        forceSelect(i);
+}
+
+void ItemList::toggleSelect(int sel)
+{
+    if (outOfRange(sel))
+        return;
+    flags_[sel] ^= SELECTED;
+    dirty_.push_back(sel);
+}
+
+bool ItemList::isSelected(int idx)
+{
+    return outOfRange(idx) ? false : (flags_[idx] & SELECTED) != 0;
+}
+
+void ItemList::setChanged(int idx, int val)
+{
+    if (outOfRange(idx) || changed(idx) == (val != 0))
+        return;
+    flags_[idx] ^= CHANGED;
+    dirty_.push_back(idx);
+}
+
+
+//
+// 'Fl_Image_BrowserV::ITEM::make_thumbnail()' - Make the thumbnail image.
+//
+
+// TODO what if image is smaller than THUMBSIZE?
+// KBR create a decent sized thumbnail in the first place
+//#define THUMBSIZE (ITEMWIDTH-20)
+#define THUMBSIZE 500
+
+void
+ItemList::ITEM::make_thumbnail(
+    const char *filename,		// I - Image filename
+    Fl_Image   *image)			// I - Full image if loaded, else NULL
+{
+
+  // Clear the thumbnail image as needed...
+  if (thumbnail)
+  {
+    thumbnail->release();
+    thumbnail = nullptr;
+  }
+
+  // Create the thumbnail image...
+  if (image)
+    thumbnail = (Fl_Shared_Image *)scale_thumbnail(image);
+  else
+  {
+    Fl_Shared_Image *shared = Fl_Shared_Image::get(filename);
+
+    if (shared)
+    {
+      thumbnail = (Fl_Shared_Image *)scale_thumbnail(shared);
+      shared->release();
+    }
+  }
+
+  // Hashed while the pixels are at hand
+  hashed = thumbnail && image_dhash(thumbnail, dhash);
+}
+
+
+//
+// 'ItemList::ITEM::load_thumbnail()' - Read the cached thumbnail or make it.
+//
+
+void
+ItemList::ITEM::load_thumbnail(
+    const char  *filename,		// I - Image filename
+    ThumbWriter *writer,		// I - Write-behind queue, NULL to write now
+    Fl_Image    *image)			// I - Full image if loaded, else NULL
+{
+  char	thumbname[1024];		// Thumbnail filename
+
+
+  loaded = 1;
+
+  if (thumbnail)
+  {
+    thumbnail->release();
+    thumbnail = nullptr;
+  }
+
+  // A thumbnail older than its image is regenerated
+  if (find_thumbnail(filename, thumbname, sizeof(thumbname)) &&
+      (thumbnail = Fl_Shared_Image::get(thumbname)) != NULL)
+  {
+    // Stored when the thumbnail was made; older ones are hashed now
+    hashed = thumb_hash(thumbname, dhash) || image_dhash(thumbnail, dhash);
+    return;
+  }
+
+  // Make it, from the full image if that is loaded. If another process
+  // is making the cache file, or it can't be cached at all, this copy is
+  // only for showing.
+  make_thumbnail(filename, image);
+
+  if (!thumb_path(filename, thumbname, sizeof(thumbname)) ||
+      !claim_thumbnail(thumbname))
+    return;
+
+  save_thumbnail(filename, writer, 0, true);
+}
+
+
+//
+// 'Fl_Image_BrowserV::ITEM::save_thumbnail()' - Save the thumbnail image.
+//
+
+void
+ItemList::ITEM::save_thumbnail(
+    const char  *filename,		// I - Image filename
+    ThumbWriter *writer,		// I - Write-behind queue, NULL to write now
+    int         createit,		// I - 1 = create thumbnail image
+    bool        claimed)		// I - Release the claim once written
+{
+  char	thumbname[1024];		// Thumbnail filename
+
+
+  // Create the thumbnail image as needed...
+  if (createit || !thumbnail)
+    make_thumbnail(filename);
+
+  if (!thumb_path(filename, thumbname, sizeof(thumbname)))
+    return;
+
+  if (!thumbnail)
+  {
+    if (claimed)
+      release_thumbnail(thumbname);
+    return;
+  }
+
+  if (!writer)
+  {
+    write_thumbnail(filename, thumbname, thumbnail, hashed ? &dhash : nullptr);
+    if (claimed)
+      release_thumbnail(thumbname);
+    return;
+  }
+
+  std::vector<unsigned char> data = writer->buffer();
+
+  if (encode_thumbnail(filename, thumbnail, hashed ? &dhash : nullptr, data))
+    writer->write(thumbname, std::move(data), claimed);
+  else if (claimed)
+    release_thumbnail(thumbname);
+}
+
+
+const char *ItemList::IMAGE_PATTERN =
+    "*.{arw,avi,bay,bmp,bmq,cr2,crw,cs1,dc2,dcr,dng,"
+    "erf,fff,hdr,jpg,k25,kdc,mdc,mos,nef,orf,pcd,pef,"
+    "png,pxn,raf,raw,rdc,sr2,srf,sti,tif,x3f}";
+
+
+//
+// 'ItemList::thumb_caches()' - Choose the thumbnail caches.
+//
+// New thumbnails go to 'primary'; existing ones are also looked for in
+// 'fallback'. The caches are not owned.
+//
+
+void
+ItemList::thumb_caches(
+    ThumbCache *primary,		// I - Cache to read and write
+    ThumbCache *fallback)		// I - Cache to also read, or NULL
+{
+  cache_    = primary;
+  fallback_ = fallback;
+}
+
+//
+// 'ItemList::thumb_caches()' - Choose the thumbnail caches by name.
+//
+// "xvpics", "freedesktop", or both separated by a comma with the primary
+// first.
+//
+
+bool					// O - false if a name is unknown
+ItemList::thumb_caches(const char *spec)	// I - Cache names
+{
+  static XvpicsCache      xvpics;
+  static FreedesktopCache freedesktop;
+  ThumbCache              *chosen[2] = { nullptr, nullptr };
+  const char              *comma = strchr(spec, ',');
+
+
+  for (int i = 0; i < (comma ? 2 : 1); i ++)
+  {
+    const char *name = i ? comma + 1 : spec;
+    size_t     len   = i || !comma ? strlen(name) : (size_t)(comma - spec);
+
+    if (len == 6 && !strncmp(name, "xvpics", 6))
+      chosen[i] = &xvpics;
+    else if (len == 11 && !strncmp(name, "freedesktop", 11))
+      chosen[i] = &freedesktop;
+    else
+      return false;
+  }
+
+  thumb_caches(chosen[0], chosen[1] != chosen[0] ? chosen[1] : nullptr);
+  return true;
+}
+
+//
+// 'ItemList::thumb_path()' - Get the filename for a new thumbnail.
+//
+
+bool					// O - false if it can't be cached
+ItemList::thumb_path(
+    const char *filename,		// I - Image filename
+    char       *thumbname,		// O - Thumbnail filename
+    int        size)			// I - Size of thumbname buffer
+{
+  return cache_->path(filename, thumbname, size);
+}
+
+//
+// 'ItemList::find_thumbnail()' - Find a current cached thumbnail.
+//
+
+bool					// O - true if found
+ItemList::find_thumbnail(
+    const char *filename,		// I - Image filename
+    char       *thumbname,		// O - Thumbnail filename
+    int        size)			// I - Size of thumbname buffer
+{
+  return cache_->find(filename, thumbname, size) ||
+         (fallback_ && fallback_->find(filename, thumbname, size));
+}
+
+//
+// 'ItemList::thumb_hash()' - Get the hash stored with a cached thumbnail.
+//
+
+bool					// O - true if it has one
+ItemList::thumb_hash(
+    const char *thumbname,		// I - Thumbnail filename
+    uint64_t   &hash)			// O - image_dhash()
+{
+  // Only the cache whose format the file is in will find one
+  return cache_->hash(thumbname, hash) ||
+         (fallback_ && fallback_->hash(thumbname, hash));
+}
+
+//
+// 'ItemList::thumb_valid()' - Is a thumbnail in the primary cache current?
+//
+
+bool					// O - true if usable
+ItemList::thumb_valid(
+    const char *filename,		// I - Image filename
+    const char *thumbname)		// I - Thumbnail filename
+{
+  return cache_->valid(filename, thumbname);
+}
+
+
+//
+// 'ItemList::decode_image()' - Load an image without the shared image cache.
+//
+// The caller owns (and deletes) the returned image. Formats FLTK has a
+// direct decoder for are recognized by their header. Anything else goes
+// through Fl_Shared_Image if 'shared' allows, serialized among the
+// callers of decode_image() only: the main thread uses its cache without
+// this lock, so the browser's workers leave those formats to it.
+//
+
+Fl_Image *				// O - Image or NULL
+ItemList::decode_image(
+    const char *filename,		// I - Image filename
+    bool       shared)			// I - Fall back to Fl_Shared_Image?
+{
+  static std::mutex sharedLock;		// Guards Fl_Shared_Image
+  uchar		header[8];		// Start of the file
+  FILE		*fp;			// Image file
+  Fl_Image	*image;			// Decoded image
+
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    return NULL;
+
+  size_t len = fread(header, 1, sizeof(header), fp);
+  fclose(fp);
+
+  if (len >= 3 && header[0] == 0xff && header[1] == 0xd8 && header[2] == 0xff)
+    image = new Fl_JPEG_Image(filename);
+  else if (len == 8 && !memcmp(header, "\211PNG\r\n\032\n", 8))
+    image = new Fl_PNG_Image(filename);
+  else if (len >= 2 && !memcmp(header, "BM", 2))
+    image = new Fl_BMP_Image(filename);
+  else if (len >= 6 && (!memcmp(header, "GIF87a", 6) || !memcmp(header, "GIF89a", 6)))
+    image = new Fl_GIF_Image(filename);
+  else if (len >= 2 && header[0] == 'P' && header[1] >= '1' && header[1] <= '7')
+    image = new Fl_PNM_Image(filename); // including .xvpics thumbnails
+  else if (shared)
+  {
+    std::lock_guard<std::mutex> guard(sharedLock);
+
+    Fl_Shared_Image *img = Fl_Shared_Image::get(filename);
+    if (!img)
+      return NULL;
+
+    image = img->copy(img->w(), img->h());
+    img->release();
+  }
+  else
+    return NULL;
+
+  if (image->fail() || !image->w() || !image->h())
+  {
+    delete image;
+    return NULL;
+  }
+
+  return image;
+}
+
+
+//
+// 'ItemList::decode_preview()' - Quickly decode a JPEG at 1/8 scale.
+//
+// At 1/8 scale libjpeg only needs each 8x8 block's DC coefficient, so
+// there is no inverse DCT and no upsampling: most of the cost is the
+// entropy decoding. Good enough for a blurry stand-in. NULL for other
+// formats and for anything libjpeg objects to.
+//
+
+struct PREVIEW_ERROR
+{
+  jpeg_error_mgr	pub;
+  jmp_buf		jump;
+};
+
+static void
+preview_error(j_common_ptr cinfo)	// I - Decompressor
+{
+  longjmp(((PREVIEW_ERROR *)cinfo->err)->jump, 1);
+}
+
+static void
+preview_message(j_common_ptr)		// I - Decompressor (not used)
+{
+  // Warnings about corrupt data don't matter for a preview
+}
+
+Fl_Image *				// O - Preview or NULL
+ItemList::decode_preview(
+    const char *filename)		// I - Image filename
+{
+  FILE				*fp;	// JPEG file
+  jpeg_decompress_struct	cinfo;	// Decompressor
+  PREVIEW_ERROR			jerr;	// Error handler
+  uchar * volatile		pixels = nullptr; // survives longjmp()
+
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    return nullptr;
+
+  cinfo.err                 = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit       = preview_error;
+  jerr.pub.output_message   = preview_message;
+
+  if (setjmp(jerr.jump))
+  {
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    delete[] pixels;
+    return nullptr;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_stdio_src(&cinfo, fp);
+
+  if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK ||
+      (cinfo.num_components != 1 && cinfo.num_components != 3))
+    longjmp(jerr.jump, 1);
+
+  cinfo.scale_num              = 1;
+  cinfo.scale_denom            = 8;
+  cinfo.dct_method             = JDCT_IFAST;
+  cinfo.do_fancy_upsampling    = FALSE;
+  cinfo.do_block_smoothing     = FALSE;
+  cinfo.quantize_colors        = FALSE;
+  cinfo.out_color_space        = cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+
+  jpeg_start_decompress(&cinfo);
+
+  int W = cinfo.output_width, H = cinfo.output_height, D = cinfo.output_components;
+
+  pixels = new uchar[(size_t)W * H * D];
+
+  while (cinfo.output_scanline < cinfo.output_height)
+  {
+    JSAMPROW row = pixels + (size_t)cinfo.output_scanline * W * D;
+
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  fclose(fp);
+
+  Fl_RGB_Image *image = new Fl_RGB_Image(pixels, W, H, D);
+  image->alloc_array = 1;
+
+  // Very large photos are still bigger than a thumbnail at 1/8
+  if (W > THUMBSIZE || H > THUMBSIZE)
+  {
+    Fl_Image *thumb = scale_thumbnail(image);
+
+    delete image;
+    return thumb;
+  }
+
+  return image;
+}
+
+
+//
+// 'ItemList::preview()' - Show a quick stand-in until the thumbnail is loaded.
+//
+// Only worth it when the thumbnail has to be made: a cached one loads
+// about as fast as the preview would decode.
+//
+
+bool					// O - true if a preview was made
+ItemList::preview(int i)		// I - Index
+{
+  ITEM *item = items_[i];
+  char filename[1024],			// Image filename
+       thumbname[1024];			// Thumbnail filename
+
+
+  if (item->loaded || item->previewed || item->thumbnail || item->packed)
+    return false;
+
+  item->previewed = true;
+
+  this->filename(i, filename, sizeof(filename));
+
+  if (find_thumbnail(filename, thumbname, sizeof(thumbname)))
+    return false;
+
+  // load_thumbnail() replaces it with the real one; shared like any other
+  // thumbnail, as it is release()d
+  Fl_Image *image = decode_preview(filename);
+
+  if (image)
+    item->thumbnail = Fl_Shared_Image::get((Fl_RGB_Image *)image);
+
+  pack(item);
+
+  return item->packed || item->thumbnail;
+}
+
+
+//
+// 'ItemList::read_thumbnail()' - Read the cached thumbnail or make it, on any thread.
+//
+// As ITEM::load_thumbnail(), but without Fl_Shared_Image [see
+// decode_image()], so NULL for images which need it as well as for those
+// which can't be read. A thumbnail which has to be made is written to
+// the cache here, unless another process is making it.
+//
+
+Fl_Image *				// O - Thumbnail, owned by the caller
+ItemList::read_thumbnail(
+    const char *filename,		// I - Image filename
+    uint64_t   &dhash,			// O - image_dhash() of the thumbnail
+    bool       &hashed)			// O - Was it hashed?
+{
+  char		thumbname[1024];	// Thumbnail filename
+  Fl_Image	*thumb;			// Thumbnail
+
+
+  hashed = false;
+
+  if (find_thumbnail(filename, thumbname, sizeof(thumbname)) &&
+      (thumb = decode_image(thumbname)) != NULL)
+  {
+    hashed = thumb_hash(thumbname, dhash) || image_dhash(thumb, dhash);
+    return thumb;
+  }
+
+  Fl_Image *image = decode_image(filename);
+
+  if (!image)
+    return NULL;
+
+  thumb = scale_thumbnail(image);
+  delete image;
+
+  if (!thumb)
+    return NULL;
+
+  hashed = image_dhash(thumb, dhash);
+
+  if (thumb_path(filename, thumbname, sizeof(thumbname)) &&
+      claim_thumbnail(thumbname))
+  {
+    write_thumbnail(filename, thumbname, thumb, hashed ? &dhash : nullptr);
+    release_thumbnail(thumbname);
+  }
+
+  return thumb;
+}
+
+
+//
+// 'ItemList::scale_thumbnail()' - Make a thumbnail sized copy of an image.
+//
+
+Fl_Image *				// O - Thumbnail or NULL
+ItemList::scale_thumbnail(
+    Fl_Image *image)			// I - Full size image
+{
+
+  if (!image->w() || !image->h())
+    return NULL;
+
+  // Size the thumbnail within a THUMBSIZE box...
+  int W = THUMBSIZE;
+  int H = W * image->h() / image->w();
+
+  if (image->h() > image->w()) //(H > THUMBSIZE)
+  {
+    H = THUMBSIZE;
+    W = H * image->w() / image->h();
+  }
+
+  return image->copy(W, H);
+}
+
+
+//
+// 'ItemList::write_thumbnail()' - Write a thumbnail to the cache.
+//
+
+bool					// O - true on success
+ItemList::write_thumbnail(
+    const char     *filename,		// I - Image filename
+    const char     *thumbname,		// I - Thumbnail filename
+    Fl_Image       *thumb,		// I - Thumbnail image
+    const uint64_t *dhash)		// I - Its image_dhash(), NULL if not known
+{
+  std::vector<unsigned char> data;	// File contents
+
+
+  return encode_thumbnail(filename, thumb, dhash, data) &&
+         store_thumbnail(thumbname, data.data(), data.size());
+}
+
+//
+// 'claim_abandoned()' - Is a claim left by a process which died?
+//
+// A claim holds its maker's pid and host. One made on this host is
+// abandoned once that process is gone; one from another host [a shared
+// directory], or one not written out yet, only once it is CLAIM_STALE
+// seconds old. That is far longer than any thumbnail takes to make.
+//
+
+#define CLAIM_STALE 3600
+
+static bool				// O - true if it may be broken
+claim_abandoned(
+    const char        *lockname,	// I - Claim filename
+    const struct stat &lockinfo)	// I - Its status
+{
+  char	owner[320],			// Claim contents
+	host[256],			// Its host
+	ours[256];			// This host
+  int	fd,				// Claim file
+	pid;				// Its process
+  ssize_t len = -1;			// Bytes read
+
+
+  if ((fd = open(lockname, O_RDONLY)) >= 0)
+  {
+    len = read(fd, owner, sizeof(owner) - 1);
+    close(fd);
+  }
+
+  if (len > 0)
+  {
+    owner[len] = '\0';
+
+    if (sscanf(owner, "%d %255s", &pid, host) == 2 && pid > 0 &&
+        !gethostname(ours, sizeof(ours)) && !strcmp(host, ours))
+      return kill(pid, 0) && errno == ESRCH;
+  }
+
+  return time(NULL) - lockinfo.st_mtime >= CLAIM_STALE;
+}
+
+
+//
+// 'ItemList::claim_thumbnail()' - Claim the making of a thumbnail.
+//
+// Browsers and ThumbsWarm, in any number of processes, may thumbnail the
+// same directory. Whoever creates "thumbname.lock" (O_EXCL) makes the
+// thumbnail; the others leave it to them. An abandoned claim [see
+// claim_abandoned()] is broken. If no lock can be made at all [e.g. a
+// read-only directory] the caller goes ahead.
+//
+// Breaking a claim is a rename() aside, which only one process can do.
+// Should the claim set aside turn out to be a new one, made since the
+// abandoned one was looked at, it is put back.
+//
+
+bool					// O - true if the caller should make it
+ItemList::claim_thumbnail(
+    const char *thumbname)		// I - Thumbnail filename
+{
+  static std::atomic<unsigned> breaks(0);	// Tells this process's breakers apart
+  char		lockname[1100],		// Claim filename
+		stalename[1200],	// Claim set aside
+		thumbdir[1024],		// Thumbnail directory
+		*ptr;			// Pointer into thumbdir
+  struct stat	lockinfo,		// Claim found
+		staleinfo;		// Claim set aside
+  int		fd;			// Claim file
+
+
+  snprintf(lockname, sizeof(lockname), "%s.lock", thumbname);
+
+  for (int tries = 0; tries < 3; tries ++)
+  {
+    if ((fd = open(lockname, O_WRONLY | O_CREAT | O_EXCL, 0666)) >= 0)
+    {
+      char owner[320],			// Pid and host, for claim_abandoned()
+           host[256];
+
+      if (gethostname(host, sizeof(host)))
+        strlcpy(host, "localhost", sizeof(host));
+      host[sizeof(host) - 1] = '\0';
+
+      int len = snprintf(owner, sizeof(owner), "%d %s\n", (int)getpid(), host);
+
+      ssize_t written = write(fd, owner, std::min(len, (int)sizeof(owner) - 1));
+      (void)written; // without it the claim is only broken by age
+      close(fd);
+      return true;
+    }
+
+    if (errno == ENOENT)
+    {
+      // The .xvpics directory may not exist yet
+      strlcpy(thumbdir, thumbname, sizeof(thumbdir));
+      if ((ptr = strrchr(thumbdir, '/')) == NULL)
+        return true;
+      *ptr = '\0';
+      fl_mkdir(thumbdir);
+      continue;
+    }
+
+    if (errno != EEXIST)
+      return true;
+
+    if (stat(lockname, &lockinfo)) // released meanwhile
+      continue;
+
+    if (!claim_abandoned(lockname, lockinfo))
+      return false;
+
+    snprintf(stalename, sizeof(stalename), "%s.%d.%u", lockname, (int)getpid(),
+             breaks ++);
+
+    if (rename(lockname, stalename)) // released, or broken by someone else
+      continue;
+
+    if (!stat(stalename, &staleinfo) &&
+        (staleinfo.st_ino != lockinfo.st_ino || staleinfo.st_dev != lockinfo.st_dev))
+    {
+      // Not the abandoned claim: give it back, unless another has been
+      // made meanwhile
+      link(stalename, lockname);
+      unlink(stalename);
+      return false;
+    }
+
+    unlink(stalename);
+  }
+
+  return false;
+}
+
+//
+// 'ItemList::release_thumbnail()' - Give up a claim once the thumbnail is written.
+//
+
+void
+ItemList::release_thumbnail(
+    const char *thumbname)		// I - Thumbnail filename
+{
+  char	lockname[1100];			// Claim filename
+
+
+  snprintf(lockname, sizeof(lockname), "%s.lock", thumbname);
+  unlink(lockname);
+}
+
+//
+// 'ItemList::encode_thumbnail()' - Encode a thumbnail in the cache's format.
+//
+
+bool					// O - false if the image can't be encoded
+ItemList::encode_thumbnail(
+    const char                 *filename,	// I - Image filename
+    Fl_Image                   *thumb,		// I - Thumbnail image
+    const uint64_t             *dhash,		// I - Its image_dhash(), NULL if not known
+    std::vector<unsigned char> &data)		// O - File contents
+{
+  return cache_->encode(filename, thumb, dhash, data);
+}
+
+//
+// 'ItemList::store_thumbnail()' - Write a thumbnail file.
+//
+// The file is written under a temporary name and renamed, so a reader
+// never sees a partial thumbnail. It, and any cache directory made for
+// it, is private to the user, as the freedesktop.org standard asks.
+//
+
+bool					// O - true on success
+ItemList::store_thumbnail(
+    const char          *thumbname,	// I - Thumbnail filename
+    const unsigned char *data,		// I - File contents
+    size_t              length)		// I - Length of contents
+{
+  int		fd;			// Thumbnail file
+  char		tempname[1100],		// Temporary filename
+		thumbdir[1024],		// Thumbnail directory
+		*ptr;			// Pointer into thumbdir
+
+
+  static std::atomic<unsigned> serial(0);
+
+  // Unique between processes and between threads
+  snprintf(tempname, sizeof(tempname), "%s.%d.%u", thumbname, (int)getpid(),
+           serial++);
+
+  if ((fd = open(tempname, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0)
+  {
+    // The cache directory may not exist yet [.xvpics, or any part of
+    // ~/.cache/thumbnails/size]
+    strlcpy(thumbdir, thumbname, sizeof(thumbdir));
+    if ((ptr = strrchr(thumbdir, '/')) == NULL)
+      return false;
+    *ptr = '\0';
+
+    for (ptr = strchr(thumbdir + 1, '/'); ptr; ptr = strchr(ptr + 1, '/'))
+    {
+      *ptr = '\0';
+      fl_mkdir(thumbdir);
+      *ptr = '/';
+    }
+    fl_mkdir(thumbdir);
+
+    if ((fd = open(tempname, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0)
+      return false;
+  }
+
+  while (length > 0)
+  {
+    ssize_t written = write(fd, data, length);
+
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      break;
+
+    data   += written;
+    length -= written;
+  }
+
+  if (close(fd) || length || rename(tempname, thumbname))
+  {
+    unlink(tempname);
+    return false;
+  }
+
+  return true;
+}
+
+//
+// 'ItemList::dimensions()' - Get the full image size of an item.
+//
+// Falls back to the thumbnail's aspect ratio if the header probe failed.
+//
+
+bool					// O - false if unknown
+ItemList::dimensions(
+    int i,				// I - Index
+    int &w,				// O - Width
+    int &h)				// O - Height
+{
+  ITEM *item = items_[i];
+
+  if (width_[i] > 0 && height_[i] > 0)
+  {
+    w = width_[i];
+    h = height_[i];
+    return true;
+  }
+
+  if (item->packed)
+  {
+    w = item->packed->w();
+    h = item->packed->h();
+    return true;
+  }
+
+  if (item->thumbnail && item->thumbnail->w() && item->thumbnail->h())
+  {
+    w = item->thumbnail->w();
+    h = item->thumbnail->h();
+    return true;
+  }
+
+  w = h = 0;
+  return false;
 }
@@ -2,35 +2,141 @@
 #define _ITEMLIST_H_
 
 #include <FL/Fl_Shared_Image.H>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-class ItemList
+#include "ImageModel.h"
+#include "ThumbLoader.h"
+
+class ImageCache;
+class ImagePrefetcher;
+class PackedImage;
+class ThumbCache;
+class ThumbPool;
+class ThumbWriter;
+
+class ItemList : public ImageModel
 {
 public:
     
+  // The file is dirname(dir) + "/" + label [a relative name has a dir of
+  // "", the root one of "/"]; the thumbnail path is derived from it with
+  // thumb_path() when needed. Full images are kept in the list's
+  // ImageCache, by id.
+  //
+  // 'thumbnail' only holds pixels while the thumbnail is being made,
+  // hashed and saved; the list then keeps it as 'packed' and unpacks it
+  // into its ThumbPool to draw [see pack() and ItemList::thumbnail()],
+  // unless packing is off [see pack_thumbnails()].
   struct ITEM
   {
-    char            *filename;
-    char            *thumbname;
-    char            *label;
+    unsigned        dir;        // interned directory, see dirname()
+    const char      *label;     // base name, in the list's name arena
     char            *comments;
-    Fl_Shared_Image *image;
     Fl_Shared_Image *thumbnail;
-    int             changed;
-    int             selected;
+    PackedImage     *packed;
+    unsigned        id;         // see ImageModel::id()
+    int             loaded;     // thumbnail load has been attempted
+    unsigned long   ticket;     // ThumbLoader job under way, 0 if none
+    bool            previewed;  // preview attempted [thumbnail may be it]
+    bool            unthreaded; // thumbnail is made on the main thread
+    bool            hashed;     // dhash is known
+    uint64_t        dhash;      // image_dhash() of the thumbnail
+    time_t          mtime;      // file fingerprint when the item was made
+    off_t           size;
 
-    void make_thumbnail();
-    void save_thumbnail(int createit = 0);
-    
-    int _x;
-    int _y;
-    int _w;
-    int _h;
+    void load_thumbnail(const char *filename, ThumbWriter *writer = nullptr,
+                        Fl_Image *image = nullptr);
+    void make_thumbnail(const char *filename, Fl_Image *image = nullptr);
+    void save_thumbnail(const char *filename, ThumbWriter *writer = nullptr,
+                        int createit = 0, bool claimed = false);
   };
 
 private:  
   ITEM **items_;
   int    num_items_;
   int    alloc_items_;
+
+  // Per-item state which layout, drawing and selection go through for
+  // every item, in arrays parallel to items_ so those passes stream
+  // through memory instead of visiting each ITEM.
+  enum { SELECTED = 1, CHANGED = 2 };
+  std::vector<unsigned char> flags_;
+  std::vector<int>           width_;   // full image size, from the header
+  std::vector<int>           height_;  // probe; 0 if unknown
+
+  std::vector<int> dirty_; // items whose selected/changed state changed
+
+  ThumbWriter *writer_;    // thumbnail cache writes, started when needed
+  ThumbWriter *writer();
+
+  // Full images, and those decoded ahead of load_item() [see prefetch()]
+  ImageCache            *images_;
+  ImagePrefetcher       *prefetcher_;
+  int                   prefetchCount_;
+  unsigned              shown_;    // item last loaded, 0 if none
+  std::vector<unsigned> around_;   // items last prefetched
+
+  void        pin_images();
+
+  // Thumbnails being drawn, unpacked; packedBytes_ is what all of the
+  // packed thumbnails take
+  ThumbPool             *thumbs_;
+  size_t                packedBytes_;
+
+  void        pack(ITEM *item, PackedImage *packed = nullptr);
+  static void image_ready(unsigned id, int index, Fl_RGB_Image *image, void *d);
+
+  // Thumbnails fetch() has a worker load or make [see ThumbLoader]
+  ThumbLoader           *loader_;
+  unsigned long         tickets_;
+  void                  (*readyCb_)(int i, void *data);
+  void                  *readyData_;
+
+  static void thumb_ready(ThumbLoader::RESULT &result, void *d);
+
+  static unsigned next_id_;
+
+  static ThumbCache *cache_;     // where thumbnails are read and made
+  static ThumbCache *fallback_;  // also read from, or NULL
+  static bool       pack_;      // see pack_thumbnails()
+
+  // Directory names are stored once and base names are packed into large
+  // blocks, rather than two full paths allocated per item. Names of
+  // deleted items are only reclaimed by clear().
+  std::vector<char *>                       dirs_;
+  std::unordered_map<std::string, unsigned> dirIds_;
+  std::vector<char *>                       arena_;
+  size_t                                    arenaLeft_;
+
+  unsigned    intern_dir(const char *dir, size_t len);
+  const char *store_name(const char *name);
+  void        free_names();
+
+  // changes_ counts changes to the items or their order
+  unsigned long changes_;
+
+  void  destroy_item(ITEM *item);
+
+  // Index of each id and of each filename, rebuilt on the first lookup
+  // after a change; appending keeps them current [see index(), find()]
+  std::unordered_map<unsigned, int>    index_;
+  unsigned long                        indexAt_;
+  std::unordered_map<std::string, int> names_;
+  unsigned long                        namesAt_;
+
+  static std::string name_key(const char *filename);
+
+  void  reorder(const std::vector<int> &order);
+
+  ITEM *new_item(const char *f, Fl_Shared_Image *img);
+  void  add_to_array(ITEM *item, int i, int width, int height);
+  void  free_item(ITEM *item);
+  void  shift_item(int from, int to);
+  void  truncate(int n);
   
 public:
     ItemList();
@@ -38,17 +144,70 @@ public:
     
   void  delete_item(int i);
   ITEM *insert_item(const char *f, Fl_Shared_Image *img, int i = __INT_MAX__);
+  ITEM *add_item(const char *f, int width, int height, time_t mtime, off_t size);
+  bool  load_thumbnail(int i);
+  void  refresh(int i, time_t mtime, off_t size, int width, int height);
   void  move_item(int from, int to);
+  void  reserve(int n);
+
+  // Several items at once, in a single pass over the array. Indices
+  // change, so the dirty list is cleared: repaint everything.
+  int   remove(const std::vector<int> &indices);
+  int   remove_selected();
+  int   move_selected(int to);
+
+  // Keys are gathered once, in parallel: file times and sizes from stat,
+  // dimensions from the header probe [kept], dates from EXIF, else the
+  // file time. Ties keep their order. Selection moves with the items;
+  // returns the new index of 'anchor'.
+  enum SORT { BY_NAME, BY_NATURAL, BY_MTIME, BY_SIZE, BY_DIMENSIONS, BY_DATE };
+  int   sort(SORT by, bool descending = false, int anchor = -1);
+
+  // strcmp() with digit runs compared by value: "img2" < "img10"
+  static int natural_compare(const char *a, const char *b);
+
+  // Groups of near-duplicate items [see hash_clusters()], among those
+  // hashed so far. Hashes stored with cached thumbnails are read in
+  // parallel; items without one are fetch()ed, and 'pending' says how
+  // many are still being hashed: call again for the full groups.
+  std::vector<std::vector<int> > duplicates(int maxDistance = 6,
+                                            int *pending = nullptr);
+
+  // Where the item with an id [see ImageModel::id()] is now; -1 if gone
+  int   index(unsigned id);
 
   bool outOfRange(int val) { return val < 0 || val >= num_items_; }
 
-  int find(int x, int y);
   int find(const char *filename);
   Fl_Shared_Image *load_item(int i);
 
+  // Full images decoded ahead on each side of the viewed item
+  int  prefetchCount() const { return prefetchCount_; }
+  void prefetchCount(int n) { prefetchCount_ = n; }
+
+  // Full images loaded so far: size limit and statistics
+  ImageCache *imageCache() { return images_; }
+
+  // Called on the main thread with the index of an item whose thumbnail
+  // came in from a worker [see fetch()]. Needs Fl::lock(), as for
+  // ImagePrefetcher.
+  void thumbnailCallback(void (*cb)(int i, void *data), void *data)
+  { readyCb_ = cb; readyData_ = data; }
+
+  // Unpacked thumbnails: size limit and statistics; and the memory the
+  // packed thumbnails of all items take
+  ThumbPool  *thumbPool() { return thumbs_; }
+  size_t      packedBytes() const { return packedBytes_; }
+
+  const char *dirname(int i) { return dirs_[items_[i]->dir]; }
+  void        filename(int i, char *buf, int size);
+
+  // Wait until the thumbnails made so far are in the cache
+  void flush();
+
   int		count() const { return num_items_; }
 
-  int		selected(int i) { return outOfRange(i) ? 0 : items_[i]->selected; }
+  int		selected(int i) { return outOfRange(i) ? 0 : flags_[i] & SELECTED; }
   
   ITEM *get(int i) { return outOfRange(i) ? nullptr : items_[i]; }
   ITEM *getUnsafe(int i) { return items_[i]; }
@@ -61,6 +220,65 @@ public:
   void selectRange(int, int);
   void forceSelect(int);
   bool isSelected(int);
+  int  changed(int i) { return outOfRange(i) ? 0 : (flags_[i] & CHANGED) != 0; }
+  void setChanged(int, int);
+
+  // Image size from the header probe, 0 if unknown
+  int  width(int i) { return width_[i]; }
+  int  height(int i) { return height_[i]; }
+  void setSize(int i, int w, int h) { width_[i] = w; height_[i] = h; }
+
+  // Items to repaint since the last clearDirty(); may hold duplicates
+  std::vector<int> &dirty() { return dirty_; }
+  void clearDirty() { dirty_.clear(); }
+
+  // ImageModel
+  const char *name(int i) { return items_[i]->label; }
+  unsigned    id(int i) { return items_[i]->id; }
+  bool        dimensions(int i, int &w, int &h);
+  Fl_Image   *thumbnail(int i);
+  const void *thumbnailKey(int i);
+  void        keepThumbnails(bool keep);
+  size_t      keepBytes();
+  bool        fetched(int i) { return items_[i]->loaded; }
+  void        fetch(int i);
+  void        fetchNow(int i) { load_thumbnail(i); }
+  void        cancelFetch();
+  bool        preview(int i);
+  void        prefetch(int i, int direction);
+
+  // Keep thumbnails BC1-packed in memory [the default], or as they are:
+  // six times the memory, but exact [see PackedImage]. For all lists;
+  // thumbnails already made stay as they are.
+  static void pack_thumbnails(bool val) { pack_ = val; }
+
+  // Thumbnail cache helpers. These do not use the Fl_Shared_Image cache,
+  // so they are safe to call from worker threads; except decode_image()
+  // with 'shared', which falls back to it for formats without a direct
+  // decoder and may only be used where nothing else touches that cache
+  // at the same time [ThumbsWarm, but not the browser's workers].
+  static const char *IMAGE_PATTERN;  // files we import, for fl_filename_match
+
+  static void       thumb_caches(ThumbCache *primary, ThumbCache *fallback = nullptr);
+  static bool       thumb_caches(const char *spec);
+  static bool       thumb_path(const char *filename, char *thumbname, int size);
+  static bool       thumb_valid(const char *filename, const char *thumbname);
+  static bool       find_thumbnail(const char *filename, char *thumbname, int size);
+  static bool       thumb_hash(const char *thumbname, uint64_t &hash);
+  static bool       claim_thumbnail(const char *thumbname);
+  static void       release_thumbnail(const char *thumbname);
+  static Fl_Image  *decode_image(const char *filename, bool shared = false);
+  static Fl_Image  *decode_preview(const char *filename);
+  static Fl_Image  *read_thumbnail(const char *filename, uint64_t &dhash,
+                                   bool &hashed);
+  static Fl_Image  *scale_thumbnail(Fl_Image *image);
+  static bool       write_thumbnail(const char *filename, const char *thumbname,
+                                    Fl_Image *thumb, const uint64_t *dhash = nullptr);
+  static bool       encode_thumbnail(const char *filename, Fl_Image *thumb,
+                                     const uint64_t *dhash,
+                                     std::vector<unsigned char> &data);
+  static bool       store_thumbnail(const char *thumbname, const unsigned char *data,
+                                    size_t length);
 };
 
 #endif // _ITEMLIST_H_
@@ -0,0 +1,279 @@
+//
+// Per-directory session manifest for ThumbsVert.
+//
+// Contents:
+//
+//   Manifest::open()  - Map the manifest for a directory.
+//   Manifest::close() - Unmap the manifest.
+//   Manifest::path()  - Get the manifest filename for a directory.
+//   Manifest::save()  - Write the manifest for a directory.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+#  include <io.h>
+#else
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif // WIN32 && !__CYGWIN__
+
+#include "Manifest.h"
+#include "ItemList.h"
+
+#define MANIFEST_MAGIC   "TVMANIF1"
+#define MANIFEST_VERSION 1
+
+struct Manifest::HEADER
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t count;       // number of entries
+  uint32_t strings;     // size of the string table following the entries
+  int32_t  anchorItem;  // entry at the top of the viewport, -1 for none
+  double   anchorFrac;  // how far into it the viewport started
+};
+
+
+// Does the item live directly in the directory?
+static bool in_directory(ItemList *list, int i, const char *dirname)
+{
+  return !strcmp(list->dirname(i), dirname);
+}
+
+
+Manifest::Manifest()
+{
+  data_   = nullptr;
+  length_ = 0;
+  mapped_ = false;
+}
+
+Manifest::~Manifest()
+{
+  close();
+}
+
+
+//
+// 'Manifest::open()' - Map the manifest for a directory.
+//
+// A manifest which is damaged or from another version is ignored.
+//
+
+bool					// O - true if a usable manifest exists
+Manifest::open(const char *dirname)	// I - Absolute directory name
+{
+  char		filename[1024];		// Manifest filename
+  struct stat	info;			// Manifest size
+  int		fd;			// Manifest file
+
+
+  close();
+
+  path(dirname, filename, sizeof(filename));
+
+  if ((fd = ::open(filename, O_RDONLY)) < 0)
+    return false;
+
+  if (fstat(fd, &info) || (size_t)info.st_size < sizeof(HEADER))
+  {
+    ::close(fd);
+    return false;
+  }
+
+  length_ = info.st_size;
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+  data_ = new char[length_];
+  if (read(fd, data_, length_) != (int)length_)
+  {
+    delete[] data_;
+    data_ = nullptr;
+  }
+#else
+  data_ = (char *)mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data_ == MAP_FAILED)
+    data_ = nullptr;
+  else
+    mapped_ = true;
+#endif // WIN32 && !__CYGWIN__
+
+  ::close(fd);
+
+  if (!data_)
+  {
+    length_ = 0;
+    return false;
+  }
+
+  // Sanity check everything we'll index later
+  const HEADER *h = header();
+  size_t needed = sizeof(HEADER) + (size_t)h->count * sizeof(ENTRY) + h->strings;
+
+  if (memcmp(h->magic, MANIFEST_MAGIC, 8) || h->version != MANIFEST_VERSION ||
+      needed != length_ || (h->strings && data_[length_ - 1] != '\0'))
+  {
+    close();
+    return false;
+  }
+
+  for (int i = 0; i < count(); i++)
+    if (entry(i).name >= h->strings)
+    {
+      close();
+      return false;
+    }
+
+  return true;
+}
+
+
+//
+// 'Manifest::close()' - Unmap the manifest.
+//
+
+void
+Manifest::close()
+{
+
+  if (!data_)
+    return;
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+  delete[] data_;
+#else
+  if (mapped_)
+    munmap(data_, length_);
+#endif // WIN32 && !__CYGWIN__
+
+  data_   = nullptr;
+  length_ = 0;
+  mapped_ = false;
+}
+
+
+int Manifest::count() const
+{
+  return data_ ? (int)header()->count : 0;
+}
+
+const Manifest::ENTRY &Manifest::entry(int i) const
+{
+  return ((const ENTRY *)(data_ + sizeof(HEADER)))[i];
+}
+
+const char *Manifest::name(int i) const
+{
+  return data_ + sizeof(HEADER) + header()->count * sizeof(ENTRY) + entry(i).name;
+}
+
+int Manifest::anchorItem() const
+{
+  return data_ ? header()->anchorItem : -1;
+}
+
+double Manifest::anchorFrac() const
+{
+  return data_ ? header()->anchorFrac : 0.0;
+}
+
+
+//
+// 'Manifest::path()' - Get the manifest filename for a directory.
+//
+
+void
+Manifest::path(
+    const char *dirname,		// I - Directory
+    char       *manifest,		// O - Manifest filename
+    int        size)			// I - Size of manifest buffer
+{
+  snprintf(manifest, size, "%s/.xvpics/thumbsvert.manifest", dirname);
+}
+
+
+//
+// 'Manifest::save()' - Write the manifest for a directory.
+//
+// Only the items which live directly in the directory are saved. The file
+// is written under a temporary name and renamed, so a reader never sees a
+// partial manifest.
+//
+
+bool					// O - true on success
+Manifest::save(
+    const char *dirname,		// I - Absolute directory name
+    ItemList   *list,			// I - Items to save
+    int        anchorItem,		// I - Item at the top of the viewport
+    double     anchorFrac)		// I - How far into it the viewport starts
+{
+  char		filename[1024],		// Manifest filename
+		tempname[1100];		// Temporary filename
+  FILE		*fp;			// Manifest file
+  HEADER	h;			// File header
+
+
+  path(dirname, filename, sizeof(filename));
+  snprintf(tempname, sizeof(tempname), "%s.%d", filename, (int)getpid());
+
+  if ((fp = fopen(tempname, "wb")) == NULL)
+    return false;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MANIFEST_MAGIC, 8);
+  h.version    = MANIFEST_VERSION;
+  h.anchorItem = -1;
+  h.anchorFrac = anchorFrac;
+
+  // Placeholder header, rewritten once the counts are known
+  fwrite(&h, sizeof(h), 1, fp);
+
+  for (int i = 0; i < list->count(); i++)
+  {
+    ItemList::ITEM *item = list->getUnsafe(i);
+
+    if (!in_directory(list, i, dirname))
+      continue;
+
+    if (i == anchorItem)
+      h.anchorItem = h.count;
+
+    ENTRY e;
+    e.mtime    = item->mtime;
+    e.size     = item->size;
+    e.width    = list->width(i);
+    e.height   = list->height(i);
+    e.name     = h.strings;
+    e.reserved = 0;
+
+    fwrite(&e, sizeof(e), 1, fp);
+
+    h.count ++;
+    h.strings += strlen(item->label) + 1;
+  }
+
+  for (int i = 0; i < list->count(); i++)
+  {
+    ItemList::ITEM *item = list->getUnsafe(i);
+
+    if (!in_directory(list, i, dirname))
+      continue;
+
+    fwrite(item->label, strlen(item->label) + 1, 1, fp);
+  }
+
+  rewind(fp);
+  fwrite(&h, sizeof(h), 1, fp);
+
+  if (ferror(fp) | fclose(fp) || rename(tempname, filename))
+  {
+    unlink(tempname);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef _MANIFEST_H_
+#define _MANIFEST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+class ItemList;
+
+// Per-directory session manifest, kept in the .xvpics directory. Holds the
+// file list with stat fingerprints and image sizes, plus the item at the top
+// of the viewport, so a directory which was opened before can be laid out
+// and painted without touching the files. The manifest is memory-mapped
+// read-only; it is only a hint and is reconciled with the directory later.
+//
+class Manifest
+{
+public:
+
+  struct ENTRY
+  {
+    int64_t  mtime;
+    int64_t  size;
+    int32_t  width;
+    int32_t  height;
+    uint32_t name;      // offset of the file name in the string table
+    uint32_t reserved;
+  };
+
+private:
+  struct HEADER;
+
+  char        *data_;
+  size_t      length_;
+  bool        mapped_;
+
+  const HEADER *header() const { return (const HEADER *)data_; }
+
+public:
+  Manifest();
+  ~Manifest();
+
+  bool open(const char *dirname);
+  void close();
+
+  int          count() const;
+  const ENTRY &entry(int i) const;
+  const char  *name(int i) const;
+  int          anchorItem() const;
+  double       anchorFrac() const;
+
+  static void  path(const char *dirname, char *manifest, int size);
+  static bool  save(const char *dirname, ItemList *list,
+                    int anchorItem, double anchorFrac);
+};
+
+#endif // _MANIFEST_H_
@@ -0,0 +1,251 @@
+//
+// BC1 compressed images, for thumbnails held in memory.
+//
+// Contents:
+//
+//   pack_block()                - Compress one 4x4 block.
+//   PackedImage::PackedImage()  - Compress an image.
+//   PackedImage::unpack()       - Decompress to RGB.
+//
+
+#include <string.h>
+#include <algorithm> // min, swap
+
+#include "PackedImage.h"
+
+typedef unsigned char uchar;
+
+
+// RGB565 to 8 bits a channel, and back with rounding
+static inline void
+expand565(unsigned c,			// I - RGB565 color
+          int      rgb[3])		// O - RGB
+{
+  int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+static inline unsigned
+to565(const int rgb[3])			// I - RGB
+{
+  return ((rgb[0] * 31 + 127) / 255) << 11 |
+         ((rgb[1] * 63 + 127) / 255) << 5 |
+         ((rgb[2] * 31 + 127) / 255);
+}
+
+// The four colors a block's indices choose from
+static inline void
+palette(unsigned c0,			// I - First endpoint
+        unsigned c1,			// I - Second endpoint
+        uchar    pal[4][3])		// O - Colors
+{
+  int a[3], b[3];
+
+  expand565(c0, a);
+  expand565(c1, b);
+
+  for (int k = 0; k < 3; k ++)
+  {
+    pal[0][k] = (uchar)a[k];
+    pal[1][k] = (uchar)b[k];
+
+    if (c0 > c1)
+    {
+      pal[2][k] = (uchar)((2 * a[k] + b[k]) / 3);
+      pal[3][k] = (uchar)((a[k] + 2 * b[k]) / 3);
+    }
+    else // three color mode; never written here
+    {
+      pal[2][k] = (uchar)((a[k] + b[k]) / 2);
+      pal[3][k] = 0;
+    }
+  }
+}
+
+
+//
+// 'pack_block()' - Compress one 4x4 block.
+//
+// The endpoints are the corners of the block's color bounding box, pulled
+// in a little, on the diagonal that follows the colors: the channel with
+// the widest range leads and the others are flipped where they fall as
+// it rises.
+//
+
+static void
+pack_block(const uchar px[16][3],	// I - Pixels, row by row
+           uchar       *out)		// O - 8 bytes
+{
+  int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+
+
+  for (int i = 0; i < 16; i ++)
+    for (int k = 0; k < 3; k ++)
+    {
+      if (px[i][k] < lo[k]) lo[k] = px[i][k];
+      if (px[i][k] > hi[k]) hi[k] = px[i][k];
+    }
+
+  int lead = 0;
+  for (int k = 1; k < 3; k ++)
+    if (hi[k] - lo[k] > hi[lead] - lo[lead])
+      lead = k;
+
+  for (int k = 0; k < 3; k ++)
+  {
+    if (k != lead)
+    {
+      int mid0 = (lo[lead] + hi[lead]) / 2, mid = (lo[k] + hi[k]) / 2;
+      int cov  = 0;
+
+      for (int i = 0; i < 16; i ++)
+        cov += (px[i][lead] - mid0) * (px[i][k] - mid);
+
+      if (cov < 0)
+        std::swap(lo[k], hi[k]);
+    }
+
+    int inset = (hi[k] - lo[k]) / 16;
+    hi[k] -= inset;
+    lo[k] += inset;
+  }
+
+  unsigned c0 = to565(hi), c1 = to565(lo);
+  unsigned bits = 0;
+
+  if (c0 < c1)
+    std::swap(c0, c1);
+
+  if (c0 != c1) // otherwise every index is 0
+  {
+    uchar pal[4][3];
+    palette(c0, c1, pal);
+
+    // Nearest of the four by position along the line between the ends,
+    // which are 0, 2, 3 and 1 in thirds from c0 to c1. len isn't 0 as
+    // the ends differ.
+    int dir[3], len = 0, base = 0;
+    for (int k = 0; k < 3; k ++)
+    {
+      dir[k] = pal[1][k] - pal[0][k];
+      len   += dir[k] * dir[k];
+      base  += pal[0][k] * dir[k];
+    }
+
+    static const int order[4] = { 0, 2, 3, 1 };
+
+    for (int i = 0; i < 16; i ++)
+    {
+      int t = px[i][0] * dir[0] + px[i][1] * dir[1] + px[i][2] * dir[2] - base;
+      int step = std::max(0, std::min(3, (6 * t + len) / (2 * len))); // 3t/len, rounded
+
+      bits |= (unsigned)order[step] << (2 * i);
+    }
+  }
+
+  out[0] = (uchar)c0;
+  out[1] = (uchar)(c0 >> 8);
+  out[2] = (uchar)c1;
+  out[3] = (uchar)(c1 >> 8);
+  out[4] = (uchar)bits;
+  out[5] = (uchar)(bits >> 8);
+  out[6] = (uchar)(bits >> 16);
+  out[7] = (uchar)(bits >> 24);
+}
+
+
+//
+// 'PackedImage::PackedImage()' - Compress an image.
+//
+// Blocks past the right or bottom edge repeat the edge pixels.
+//
+
+PackedImage::PackedImage(Fl_Image *image)	// I - Image
+{
+  w_      = 0;
+  h_      = 0;
+  blocks_ = nullptr;
+
+  if (!image || image->count() != 1 || image->d() < 1 || !image->data() ||
+      image->w() < 1 || image->h() < 1)
+    return;
+
+  int W  = image->w();
+  int H  = image->h();
+  int D  = image->d();
+  int LD = image->ld() ? image->ld() : W * D;
+  int G  = D < 3 ? 0 : 1; // gray images have a single channel [plus alpha]
+  const uchar *pixels = (const uchar *)image->data()[0];
+
+  w_      = W;
+  h_      = H;
+  blocks_ = new uchar[bytes()];
+
+  uchar *out = blocks_;
+  uchar px[16][3];
+
+  for (int by = 0; by < H; by += 4)
+    for (int bx = 0; bx < W; bx += 4, out += 8)
+    {
+      for (int y = 0; y < 4; y ++)
+      {
+        const uchar *row = pixels + (size_t)std::min(by + y, H - 1) * LD;
+
+        for (int x = 0; x < 4; x ++)
+        {
+          const uchar *in = row + std::min(bx + x, W - 1) * D;
+
+          px[y * 4 + x][0] = in[0];
+          px[y * 4 + x][1] = in[G];
+          px[y * 4 + x][2] = in[G + G];
+        }
+      }
+
+      pack_block(px, out);
+    }
+}
+
+PackedImage::~PackedImage()
+{
+  delete[] blocks_;
+}
+
+
+//
+// 'PackedImage::unpack()' - Decompress to RGB.
+//
+
+void
+PackedImage::unpack(uchar *rgb) const	// O - 3 * w() * h() bytes
+{
+  const uchar *in     = blocks_;
+  size_t      stride  = (size_t)w_ * 3;
+
+
+  for (int by = 0; by < h_; by += 4)
+  {
+    int rows = std::min(4, h_ - by);
+
+    for (int bx = 0; bx < w_; bx += 4, in += 8)
+    {
+      uchar    pal[4][3];
+      unsigned bits = in[4] | in[5] << 8 | in[6] << 16 | (unsigned)in[7] << 24;
+      int      cols = std::min(4, w_ - bx);
+
+      palette(in[0] | in[1] << 8, in[2] | in[3] << 8, pal);
+
+      uchar *out = rgb + (size_t)by * stride + bx * 3;
+
+      for (int y = 0; y < rows; y ++, out += stride)
+      {
+        unsigned row = bits >> (8 * y);
+
+        for (int x = 0; x < cols; x ++)
+          memcpy(out + x * 3, pal[(row >> (2 * x)) & 3], 3);
+      }
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef _PACKEDIMAGE_H_
+#define _PACKEDIMAGE_H_
+
+#include <FL/Fl_Image.H>
+#include <stddef.h>
+
+// A thumbnail kept compressed in memory, as BC1 [DXT1] blocks: each 4 x 4
+// pixels are two RGB565 colors plus a 2-bit index per pixel choosing one
+// of them or one of two blends between them. 8 bytes where RGB takes 48.
+// Lossy: blocks of fine detail or sharp color edges come back blurred or
+// banded. That is hard to see at tile size, but shows when a thumbnail
+// is drawn larger, as in a big Fl_Image_BrowserV::export_sheet(); lists
+// can keep thumbnails exact instead [see ItemList::pack_thumbnails()].
+// Unpacking is a table lookup per pixel. Alpha is dropped; gray images
+// unpack as RGB.
+//
+class PackedImage
+{
+  int           w_, h_;
+  unsigned char *blocks_;
+
+  PackedImage(const PackedImage &);            // not copied
+  PackedImage &operator=(const PackedImage &);
+
+public:
+  // Empty [w() of 0] if the image has no pixel data, such as a pixmap
+  PackedImage(Fl_Image *image);
+  ~PackedImage();
+
+  int    w() const { return w_; }
+  int    h() const { return h_; }
+  size_t bytes() const { return (size_t)((w_ + 3) / 4) * ((h_ + 3) / 4) * 8; }
+
+  // Decode into 3 * w() * h() bytes of RGB
+  void   unpack(unsigned char *rgb) const;
+};
+
+#endif // _PACKEDIMAGE_H_
@@ -0,0 +1,426 @@
+//
+// Streaming PNG and JPEG output for very large images.
+//
+// Contents:
+//
+//   SheetWriter::maxSize()     - Get the largest image size for a format.
+//   SheetWriter::open()        - Start writing an image.
+//   SheetWriter::write()       - Write the next rows.
+//   SheetWriter::close()       - Finish the image.
+//   SheetWriter::abandon()     - Stop and remove a partly written image.
+//   SheetWriter::png_open()    - Write the PNG signature and header.
+//   SheetWriter::png_write()   - Filter and compress PNG rows.
+//   SheetWriter::png_deflate() - Compress, writing IDAT chunks as they fill.
+//   SheetWriter::png_close()   - Finish the PNG data stream.
+//   SheetWriter::put_chunk()   - Write a PNG chunk.
+//   SheetWriter::jpeg_open()   - Start JPEG compression.
+//   SheetWriter::jpeg_write()  - Compress JPEG rows.
+//   SheetWriter::jpeg_close()  - Finish JPEG compression.
+//
+
+#include <FL/filename.H>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <jpeglib.h>
+
+#include "SheetWriter.h"
+
+typedef unsigned char uchar;
+
+// Compressed PNG data per IDAT chunk
+#define IDAT_SIZE (256 * 1024)
+
+
+// libjpeg reports errors by calling error_exit(), which must not return
+struct SHEET_ERROR
+{
+  jpeg_error_mgr	pub;
+  jmp_buf		jump;
+};
+
+static void
+sheet_error(j_common_ptr cinfo)		// I - Compressor
+{
+  longjmp(((SHEET_ERROR *)cinfo->err)->jump, 1);
+}
+
+
+SheetWriter::SheetWriter()
+{
+  fp_     = NULL;
+  w_      = 0;
+  h_      = 0;
+  rows_   = 0;
+  failed_ = false;
+  z_      = NULL;
+  jpeg_   = NULL;
+  jerr_   = NULL;
+}
+
+SheetWriter::~SheetWriter()
+{
+  abandon();
+}
+
+
+//
+// 'SheetWriter::maxSize()' - Get the largest image size for a format.
+//
+
+int					// O - Pixels
+SheetWriter::maxSize(const char *filename)	// I - Filename
+{
+  const char *ext = fl_filename_ext(filename);
+
+  if (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg"))
+    return JPEG_MAX_DIMENSION;
+
+  return 0x7fffffff / 4; // PNG allows 2^31 - 1, but a row must fit one deflate()
+}
+
+
+//
+// 'SheetWriter::open()' - Start writing an image.
+//
+
+bool					// O - false on error
+SheetWriter::open(const char *filename,	// I - File to create
+                  int        W,		// I - Width
+                  int        H,		// I - Height
+                  int        quality)	// I - JPEG quality, 1 to 100
+{
+  abandon();
+
+  if (W < 1 || H < 1 || W > maxSize(filename) || H > maxSize(filename))
+    return false;
+
+  if ((fp_ = fopen(filename, "wb")) == NULL)
+    return false;
+
+  filename_ = filename;
+  w_        = W;
+  h_        = H;
+  rows_     = 0;
+  failed_   = false;
+
+  const char *ext  = fl_filename_ext(filename);
+  bool       jpeg = !strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg");
+
+  if (jpeg ? !jpeg_open(quality) : !png_open())
+  {
+    abandon();
+    return false;
+  }
+
+  return true;
+}
+
+
+//
+// 'SheetWriter::write()' - Write the next rows.
+//
+
+bool					// O - false on error
+SheetWriter::write(const uchar *rows,	// I - RGB pixels, 3 * w() bytes a row
+                   int         count)	// I - Number of rows
+{
+  if (!fp_ || failed_ || count > h_ - rows_)
+    return false;
+
+  if (jpeg_ ? !jpeg_write(rows, count) : !png_write(rows, count))
+  {
+    failed_ = true;
+    return false;
+  }
+
+  rows_ += count;
+  return true;
+}
+
+
+//
+// 'SheetWriter::close()' - Finish the image.
+//
+// Fails, removing the file, if fewer rows than the height were written.
+//
+
+bool					// O - false on error
+SheetWriter::close()
+{
+  if (!fp_ || failed_ || rows_ != h_ ||
+      (jpeg_ ? !jpeg_close() : !png_close()) ||
+      fflush(fp_) || ferror(fp_))
+  {
+    abandon();
+    return false;
+  }
+
+  fclose(fp_);
+  fp_ = NULL;
+  return true;
+}
+
+
+//
+// 'SheetWriter::abandon()' - Stop and remove a partly written image.
+//
+
+void
+SheetWriter::abandon()
+{
+  if (z_)
+  {
+    deflateEnd(z_);
+    delete z_;
+    z_ = NULL;
+  }
+
+  if (jpeg_)
+  {
+    jpeg_destroy_compress(jpeg_);
+    delete jpeg_;
+    delete jerr_;
+    jpeg_ = NULL;
+    jerr_ = NULL;
+  }
+
+  if (fp_)
+  {
+    fclose(fp_);
+    unlink(filename_.c_str());
+    fp_ = NULL;
+  }
+
+  idat_.clear();
+  row_.clear();
+}
+
+
+//
+// 'SheetWriter::png_open()' - Write the PNG signature and header.
+//
+
+bool					// O - false on error
+SheetWriter::png_open()
+{
+  uchar ihdr[13] =
+  {
+    (uchar)(w_ >> 24), (uchar)(w_ >> 16), (uchar)(w_ >> 8), (uchar)w_,
+    (uchar)(h_ >> 24), (uchar)(h_ >> 16), (uchar)(h_ >> 8), (uchar)h_,
+    8, 2, 0, 0, 0			// 8-bit RGB, no interlace
+  };
+
+  z_ = new z_stream;
+  memset(z_, 0, sizeof(z_stream));
+
+  // Fastest compression: a sheet is tens of megapixels, and the Sub
+  // filter does most of the work for photos
+  if (deflateInit(z_, Z_BEST_SPEED) != Z_OK)
+  {
+    delete z_;
+    z_ = NULL;
+    return false;
+  }
+
+  row_.resize((size_t)w_ * 3 + 1);
+  idat_.resize(IDAT_SIZE);
+  z_->next_out  = idat_.data();
+  z_->avail_out = IDAT_SIZE;
+
+  return fwrite("\211PNG\r\n\032\n", 1, 8, fp_) == 8 &&
+         put_chunk("IHDR", ihdr, sizeof(ihdr));
+}
+
+
+//
+// 'SheetWriter::png_write()' - Filter and compress PNG rows.
+//
+
+bool					// O - false on error
+SheetWriter::png_write(const uchar *rows,	// I - RGB pixels
+                       int         count)	// I - Number of rows
+{
+  size_t bytes = (size_t)w_ * 3;
+
+  for (int y = 0; y < count; y ++, rows += bytes)
+  {
+    uchar *out = row_.data();
+
+    // Sub filter: each byte less the same channel of the pixel before
+    out[0] = 1;
+    out[1] = rows[0];
+    out[2] = rows[1];
+    out[3] = rows[2];
+    for (size_t i = 3; i < bytes; i ++)
+      out[i + 1] = (uchar)(rows[i] - rows[i - 3]);
+
+    z_->next_in  = out;
+    z_->avail_in = (uInt)row_.size();
+
+    if (!png_deflate(Z_NO_FLUSH))
+      return false;
+  }
+
+  return true;
+}
+
+
+//
+// 'SheetWriter::png_deflate()' - Compress, writing IDAT chunks as they fill.
+//
+
+bool					// O - false on error
+SheetWriter::png_deflate(int flush)	// I - Z_NO_FLUSH or Z_FINISH
+{
+  for (;;)
+  {
+    int status = deflate(z_, flush);
+
+    if (status == Z_STREAM_ERROR)
+      return false;
+
+    if (z_->avail_out == 0)
+    {
+      if (!put_chunk("IDAT", idat_.data(), IDAT_SIZE))
+        return false;
+
+      z_->next_out  = idat_.data();
+      z_->avail_out = IDAT_SIZE;
+    }
+
+    if (flush == Z_FINISH ? status == Z_STREAM_END : z_->avail_in == 0)
+      return true;
+  }
+}
+
+
+//
+// 'SheetWriter::png_close()' - Finish the PNG data stream.
+//
+
+bool					// O - false on error
+SheetWriter::png_close()
+{
+  z_->next_in  = NULL;
+  z_->avail_in = 0;
+
+  if (!png_deflate(Z_FINISH))
+    return false;
+
+  size_t left = IDAT_SIZE - z_->avail_out;
+
+  deflateEnd(z_);
+  delete z_;
+  z_ = NULL;
+
+  return (!left || put_chunk("IDAT", idat_.data(), left)) &&
+         put_chunk("IEND", NULL, 0);
+}
+
+
+//
+// 'SheetWriter::put_chunk()' - Write a PNG chunk.
+//
+
+bool					// O - false on error
+SheetWriter::put_chunk(const char  *type,	// I - Chunk type
+                       const uchar *bytes,	// I - Chunk data
+                       size_t      length)	// I - Length of data
+{
+  uchar head[8], tail[4];
+
+  for (int i = 0; i < 4; i ++)
+    head[i] = (uchar)(length >> (8 * (3 - i)));
+  memcpy(head + 4, type, 4);
+
+  uLong crc = crc32(0L, head + 4, 4);
+  if (length)
+    crc = crc32(crc, bytes, (uInt)length);
+
+  for (int i = 0; i < 4; i ++)
+    tail[i] = (uchar)(crc >> (8 * (3 - i)));
+
+  return fwrite(head, 1, 8, fp_) == 8 &&
+         (!length || fwrite(bytes, 1, length, fp_) == length) &&
+         fwrite(tail, 1, 4, fp_) == 4;
+}
+
+
+//
+// 'SheetWriter::jpeg_open()' - Start JPEG compression.
+//
+// Every call into libjpeg sets its own jump point, as error_exit() can
+// only jump back to a function which is still running.
+//
+
+bool					// O - false on error
+SheetWriter::jpeg_open(int quality)	// I - Quality, 1 to 100
+{
+  jpeg_ = new jpeg_compress_struct(); // zeroed: safe to destroy if create fails
+  jerr_ = new SHEET_ERROR;
+
+  jpeg_->err             = jpeg_std_error(&jerr_->pub);
+  jerr_->pub.error_exit  = sheet_error;
+
+  if (setjmp(jerr_->jump))
+    return false;
+
+  jpeg_create_compress(jpeg_);
+  jpeg_stdio_dest(jpeg_, fp_);
+
+  jpeg_->image_width      = w_;
+  jpeg_->image_height     = h_;
+  jpeg_->input_components = 3;
+  jpeg_->in_color_space   = JCS_RGB;
+
+  jpeg_set_defaults(jpeg_);
+  jpeg_set_quality(jpeg_, quality, TRUE);
+  jpeg_start_compress(jpeg_, TRUE);
+
+  return true;
+}
+
+
+//
+// 'SheetWriter::jpeg_write()' - Compress JPEG rows.
+//
+
+bool					// O - false on error
+SheetWriter::jpeg_write(const uchar *rows,	// I - RGB pixels
+                        int         count)	// I - Number of rows
+{
+  if (setjmp(jerr_->jump))
+    return false;
+
+  for (int y = 0; y < count; y ++)
+  {
+    JSAMPROW row = (JSAMPROW)(rows + (size_t)y * w_ * 3);
+
+    jpeg_write_scanlines(jpeg_, &row, 1);
+  }
+
+  return true;
+}
+
+
+//
+// 'SheetWriter::jpeg_close()' - Finish JPEG compression.
+//
+
+bool					// O - false on error
+SheetWriter::jpeg_close()
+{
+  if (setjmp(jerr_->jump))
+    return false;
+
+  jpeg_finish_compress(jpeg_);
+  jpeg_destroy_compress(jpeg_);
+  delete jpeg_;
+  delete jerr_;
+  jpeg_ = NULL;
+  jerr_ = NULL;
+
+  return true;
+}
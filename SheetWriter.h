@@ -0,0 +1,62 @@
+#ifndef _SHEETWRITER_H_
+#define _SHEETWRITER_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+struct jpeg_compress_struct;
+struct SHEET_ERROR;
+
+// Writes a very large RGB image a few rows at a time, so the whole image
+// never has to be in memory [see Fl_Image_BrowserV::export_sheet()]. The
+// format comes from the filename: ".jpg" or ".jpeg" for JPEG, otherwise
+// PNG. The size is fixed by open(); close() must be called after the
+// last row, or the partly written file is removed.
+//
+class SheetWriter
+{
+  FILE                  *fp_;
+  std::string           filename_;
+  int                   w_, h_;
+  int                   rows_;      // written so far
+  bool                  failed_;
+
+  // PNG
+  z_stream              *z_;
+  std::vector<unsigned char> row_;  // filter byte + filtered row
+  std::vector<unsigned char> idat_; // compressed, not yet written
+
+  // JPEG
+  jpeg_compress_struct  *jpeg_;
+  SHEET_ERROR           *jerr_;
+
+  bool png_open();
+  bool png_write(const unsigned char *rows, int count);
+  bool png_close();
+  bool png_deflate(int flush);
+  bool put_chunk(const char *type, const unsigned char *bytes, size_t length);
+
+  bool jpeg_open(int quality);
+  bool jpeg_write(const unsigned char *rows, int count);
+  bool jpeg_close();
+
+  void abandon();
+
+public:
+  SheetWriter();
+  ~SheetWriter();
+
+  // Largest width or height the format allows
+  static int maxSize(const char *filename);
+
+  bool open(const char *filename, int W, int H, int quality = 90);
+  bool write(const unsigned char *rows, int count);  // 3 * W bytes a row
+  bool close();
+
+  int  w() const { return w_; }
+  int  h() const { return h_; }
+};
+
+#endif // _SHEETWRITER_H_
@@ -0,0 +1,89 @@
+#ifndef _THUMBCACHE_H_
+#define _THUMBCACHE_H_
+
+#include <FL/Fl_Image.H>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Where cached thumbnails live, how they are named, when they are still
+// good, and their file format. ItemList reads from and writes to the
+// caches chosen with ItemList::thumb_caches().
+//
+class ThumbCache
+{
+public:
+  virtual ~ThumbCache() {}
+
+  virtual const char *name() const = 0;
+
+  // Thumbnail filename for an image. false if this cache can't hold one.
+  virtual bool path(const char *filename, char *thumbname, int size) = 0;
+
+  // Is the thumbnail up to date with the image?
+  virtual bool valid(const char *filename, const char *thumbname) = 0;
+
+  // A current thumbnail for an image, wherever this cache keeps them.
+  // false if there is none.
+  virtual bool find(const char *filename, char *thumbname, int size)
+  { return path(filename, thumbname, size) && valid(filename, thumbname); }
+
+  // Thumbnail file contents, including its image_dhash(): 'hash' if the
+  // caller has it already, else worked out here
+  virtual bool encode(const char *filename, Fl_Image *thumb,
+                      const uint64_t *hash,
+                      std::vector<unsigned char> &data) = 0;
+
+  // The image_dhash() stored in a thumbnail file. false if it has none
+  // [or isn't in this cache's format].
+  virtual bool hash(const char *thumbname, uint64_t &hash) = 0;
+};
+
+
+// XV thumbnails: dir/.xvpics/name, in "P7 332" format, good as long as
+// they are newer than the image. The hash is a "#DHASH:" header comment.
+//
+class XvpicsCache : public ThumbCache
+{
+public:
+  const char *name() const { return "xvpics"; }
+
+  bool path(const char *filename, char *thumbname, int size);
+  bool valid(const char *filename, const char *thumbname);
+  bool encode(const char *filename, Fl_Image *thumb, const uint64_t *hash,
+              std::vector<unsigned char> &data);
+  bool hash(const char *thumbname, uint64_t &hash);
+};
+
+
+// The freedesktop.org Thumbnail Managing Standard, as shared with file
+// managers: $XDG_CACHE_HOME/thumbnails/<size>/<md5 of the file URI>.png,
+// valid while its Thumb::MTime text matches the image. Works for images
+// on read-only media. The hash is an X-ThumbsVert::DHash text chunk.
+// Thumbnails are written at one size; other programs may only have made
+// smaller ones, which find() falls back to.
+//
+class FreedesktopCache : public ThumbCache
+{
+  std::string root_;    // .../thumbnails
+  std::string dir_;     // root_/<size>
+  int         size_;    // index of <size> in the sizes, largest first
+
+public:
+  // size is "normal" (128), "large" (256), "x-large" (512) or
+  // "xx-large" (1024)
+  FreedesktopCache(const char *size = "x-large");
+
+  const char *name() const { return "freedesktop"; }
+
+  bool path(const char *filename, char *thumbname, int size);
+  bool valid(const char *filename, const char *thumbname);
+  bool find(const char *filename, char *thumbname, int size);
+  bool encode(const char *filename, Fl_Image *thumb, const uint64_t *hash,
+              std::vector<unsigned char> &data);
+  bool hash(const char *thumbname, uint64_t &hash);
+
+  static void file_uri(const char *filename, std::string &uri);
+};
+
+#endif // _THUMBCACHE_H_
@@ -0,0 +1,218 @@
+//
+// Background loading and making of thumbnails.
+//
+// Contents:
+//
+//   ThumbLoader::add()      - Ask for a thumbnail.
+//   ThumbLoader::cancel()   - Drop the jobs not started yet.
+//   ThumbLoader::deliver()  - Hand finished thumbnails to the ready callback.
+//   ThumbLoader::awaken()   - Have the main thread deliver what is finished.
+//   ThumbLoader::awake_cb() - Deliver on the main thread.
+//   ThumbLoader::run()      - Load or make wanted thumbnails.
+//
+
+#include <FL/Fl.H>
+#include <FL/Fl_Image.H>
+#include <set>
+
+#include "ThumbLoader.h"
+#include "ItemList.h"
+#include "PackedImage.h"
+
+
+// Loaders not yet destroyed, as an Fl::awake() message can't be taken
+// back. Only used on the main thread.
+static std::set<ThumbLoader *> live;
+
+
+ThumbLoader::ThumbLoader(READY cb, void *data, int threads)
+{
+  awakening_  = false;
+  stop_       = false;
+  ready_cb_   = cb;
+  ready_data_ = data;
+
+  live.insert(this);
+
+  for (int i = 0; i < threads; i ++)
+    threads_.push_back(std::thread(&ThumbLoader::run, this));
+}
+
+ThumbLoader::~ThumbLoader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    wanted_.clear();
+  }
+
+  wake_.notify_all();
+  for (std::thread &thread : threads_)
+    thread.join();
+
+  for (RESULT &result : ready_)
+  {
+    delete result.packed;
+    delete result.image;
+  }
+
+  live.erase(this);
+}
+
+
+//
+// 'ThumbLoader::add()' - Ask for a thumbnail.
+//
+
+void
+ThumbLoader::add(JOB &&job)		// I - Thumbnail wanted
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wanted_.push_back(std::move(job));
+  }
+
+  wake_.notify_one();
+  awaken(); // in case an Fl::awake() failed
+}
+
+
+//
+// 'ThumbLoader::cancel()' - Drop the jobs not started yet.
+//
+// Jobs being worked on are finished and delivered as usual.
+//
+
+std::vector<unsigned>			// O - Ids of the dropped jobs
+ThumbLoader::cancel()
+{
+  std::vector<unsigned> ids;
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (JOB &job : wanted_)
+    ids.push_back(job.id);
+
+  wanted_.clear();
+
+  return ids;
+}
+
+
+//
+// 'ThumbLoader::deliver()' - Hand finished thumbnails to the ready callback.
+//
+
+void
+ThumbLoader::deliver()
+{
+  std::vector<RESULT> done;
+
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done.swap(ready_);
+    awakening_ = false;
+  }
+
+  for (RESULT &result : done)
+    (*ready_cb_)(result, ready_data_);
+}
+
+
+//
+// 'ThumbLoader::awaken()' - Have the main thread deliver what is finished.
+//
+// One Fl::awake() covers everything finished until the main thread gets
+// around to delivering it. If it fails [FLTK's message queue is full],
+// the next add() or finished job tries again.
+//
+
+void
+ThumbLoader::awaken()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (awakening_ || ready_.empty())
+      return;
+
+    awakening_ = true;
+  }
+
+  if (Fl::awake(awake_cb, this) != 0)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    awakening_ = false;
+  }
+}
+
+
+//
+// 'ThumbLoader::awake_cb()' - Deliver on the main thread.
+//
+
+void
+ThumbLoader::awake_cb(void *d)		// I - Loader
+{
+  ThumbLoader *loader = (ThumbLoader *)d;
+
+  if (live.count(loader))
+    loader->deliver();
+}
+
+
+//
+// 'ThumbLoader::run()' - Load or make wanted thumbnails.
+//
+// The thumbnail is packed here too, so all the main thread has left to
+// do is keep it. Unpacked, only one with pixel data is handed back, as
+// a pixmap wouldn't pack either.
+//
+
+void
+ThumbLoader::run()
+{
+
+  for (;;)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    wake_.wait(lock, [this] { return stop_ || !wanted_.empty(); });
+
+    if (stop_)
+      return;
+
+    JOB job = std::move(wanted_.front());
+    wanted_.pop_front();
+    lock.unlock();
+
+    RESULT   result = { job.id, job.ticket, nullptr, nullptr, 0, false };
+    Fl_Image *thumb = ItemList::read_thumbnail(job.filename.c_str(), result.dhash,
+                                               result.hashed);
+
+    if (thumb && !job.pack)
+    {
+      result.image = dynamic_cast<Fl_RGB_Image *>(thumb);
+
+      if (!result.image)
+        delete thumb;
+    }
+    else if (thumb)
+    {
+      result.packed = new PackedImage(thumb);
+      delete thumb;
+
+      if (!result.packed->w())
+      {
+        delete result.packed;
+        result.packed = nullptr;
+      }
+    }
+
+    lock.lock();
+    ready_.push_back(result);
+    lock.unlock();
+
+    awaken();
+  }
+}
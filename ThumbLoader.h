@@ -0,0 +1,77 @@
+#ifndef _THUMBLOADER_H_
+#define _THUMBLOADER_H_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Fl_RGB_Image;
+class PackedImage;
+
+// Reads or makes thumbnails on worker threads, so one large image doesn't
+// stall the UI [see ItemList::fetch()]. Jobs are started in the order
+// they were added: the loader knows nothing of the viewport. Keeping the
+// nearest first is up to the caller, which must add() them nearest first
+// and, when the viewport moves, cancel() the jobs not started yet and add
+// again those still wanted. Fl_Image_BrowserV::background_cb() does so,
+// through ImageModel::cancelFetch().
+//
+// Finished thumbnails, packed if the job asks, are handed to the main thread with
+// Fl::awake() as ImagePrefetcher does; the application must have called
+// Fl::lock() once before Fl::run().
+//
+class ThumbLoader
+{
+public:
+  struct JOB
+  {
+    unsigned      id;        // ImageModel::id() of the item
+    unsigned long ticket;    // tells this job from later ones for the item
+    std::string   filename;
+    bool          pack;      // hand back 'packed' rather than 'image'
+  };
+
+  struct RESULT
+  {
+    unsigned      id;
+    unsigned long ticket;
+    PackedImage   *packed;   // NULL if it couldn't be made here
+    Fl_RGB_Image  *image;    // instead of 'packed' if not packing
+    uint64_t      dhash;
+    bool          hashed;
+  };
+
+  // Called on the main thread with each result, which then owns 'packed'
+  // and 'image'
+  typedef void (*READY)(RESULT &result, void *data);
+
+private:
+  std::vector<std::thread>    threads_;
+  std::mutex                  mutex_;
+  std::condition_variable     wake_;       // work added, or stopping
+  std::deque<JOB>             wanted_;     // not started, in order
+  std::vector<RESULT>         ready_;      // done, not yet delivered
+  bool                        awakening_;  // Fl::awake() sent, not yet run
+  bool                        stop_;
+
+  READY                       ready_cb_;
+  void                        *ready_data_;
+
+  void run();
+  void awaken();
+  static void awake_cb(void *d);
+
+public:
+  ThumbLoader(READY cb, void *data, int threads);
+  ~ThumbLoader();
+
+  void                  add(JOB &&job);
+  std::vector<unsigned> cancel();
+  void                  deliver();
+};
+
+#endif // _THUMBLOADER_H_
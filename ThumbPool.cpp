@@ -0,0 +1,214 @@
+//
+// Unpacked thumbnails for the tiles being drawn.
+//
+// Contents:
+//
+//   ThumbPool::get()    - Get an unpacked copy of a thumbnail.
+//   ThumbPool::remove() - Drop an item's copy.
+//   ThumbPool::clear()  - Drop all copies and scratch buffers.
+//   ThumbPool::keep()   - Keep every copy handed out for now.
+//   ThumbPool::evict()  - Let go of least recently used copies over the limit.
+//   ThumbPool::drop()   - Let go of a copy, keeping its buffer as scratch.
+//   ThumbPool::buffer() - Get a pixel buffer, from scratch if one fits.
+//
+
+#include "ThumbPool.h"
+
+// Scratch buffers kept for reuse; thumbnails are mostly one of a couple of
+// sizes, so a few go a long way
+#define SCRATCH_MAX 4
+
+
+ThumbPool::ThumbPool(size_t maxBytes)
+{
+  bytes_    = 0;
+  maxBytes_ = maxBytes;
+  keep_     = 0;
+  counter_  = 0;
+  hits_     = 0;
+  misses_   = 0;
+}
+
+ThumbPool::~ThumbPool()
+{
+  clear();
+}
+
+
+//
+// 'ThumbPool::get()' - Get an unpacked copy of a thumbnail.
+//
+
+Fl_Image *				// O - Image, owned by the pool
+ThumbPool::get(unsigned          id,	// I - Item id
+               const PackedImage *packed)	// I - Thumbnail
+{
+  auto it = images_.find(id);
+
+  if (it != images_.end())
+  {
+    if (it->second.packed == packed)
+    {
+      hits_ ++;
+      it->second.used = ++counter_;
+      return it->second.image;
+    }
+
+    // The item has another thumbnail now
+    drop(it->second);
+    images_.erase(it);
+  }
+
+  misses_ ++;
+
+  size_t bytes = (size_t)packed->w() * packed->h() * 3;
+
+  evict(bytes);
+
+  ENTRY entry;
+  entry.packed = packed;
+  entry.pixels = buffer(bytes, entry.bytes);
+  entry.used   = ++counter_;
+
+  packed->unpack(entry.pixels);
+  entry.image = new Fl_RGB_Image(entry.pixels, packed->w(), packed->h(), 3);
+
+  images_[id] = entry;
+  bytes_ += entry.bytes;
+
+  return entry.image;
+}
+
+
+//
+// 'ThumbPool::remove()' - Drop an item's copy.
+//
+
+void
+ThumbPool::remove(unsigned id)		// I - Item id
+{
+  auto it = images_.find(id);
+
+  if (it == images_.end())
+    return;
+
+  drop(it->second);
+  images_.erase(it);
+}
+
+
+//
+// 'ThumbPool::clear()' - Drop all copies and scratch buffers.
+//
+
+void
+ThumbPool::clear()
+{
+  for (auto &it : images_)
+  {
+    delete it.second.image;
+    delete[] it.second.pixels;
+  }
+
+  for (SCRATCH &s : scratch_)
+    delete[] s.pixels;
+
+  images_.clear();
+  scratch_.clear();
+  bytes_ = 0;
+}
+
+
+//
+// 'ThumbPool::keep()' - Keep every copy handed out for now.
+//
+// For callers which hold many thumbnails at once, such as
+// Fl_Image_BrowserV::export_sheet(). Calls nest; the pool is brought back
+// within its limit by the last keep(false).
+//
+
+void
+ThumbPool::keep(bool val)		// I - Start or stop keeping
+{
+  if (val)
+    keep_ ++;
+  else if (keep_ > 0 && --keep_ == 0)
+    evict(0);
+}
+
+
+//
+// 'ThumbPool::evict()' - Let go of least recently used copies over the limit.
+//
+// The pool holds about a screenful, so a linear scan for the oldest is
+// cheap enough.
+//
+
+void
+ThumbPool::evict(size_t room)		// I - Bytes about to be added
+{
+  while (!keep_ && !images_.empty() && bytes_ + room > maxBytes_)
+  {
+    auto oldest = images_.begin();
+
+    for (auto it = images_.begin(); it != images_.end(); ++it)
+      if (it->second.used < oldest->second.used)
+        oldest = it;
+
+    drop(oldest->second);
+    images_.erase(oldest);
+  }
+}
+
+
+//
+// 'ThumbPool::drop()' - Let go of a copy, keeping its buffer as scratch.
+//
+
+void
+ThumbPool::drop(ENTRY &e)		// I - Entry, erased by the caller
+{
+  delete e.image; // doesn't own the pixels
+  bytes_ -= e.bytes;
+
+  scratch_.push_back({ e.pixels, e.bytes });
+
+  if (scratch_.size() > SCRATCH_MAX)
+  {
+    delete[] scratch_.front().pixels;
+    scratch_.erase(scratch_.begin());
+  }
+}
+
+
+//
+// 'ThumbPool::buffer()' - Get a pixel buffer, from scratch if one fits.
+//
+// The smallest scratch buffer big enough is taken, so a buffer is never
+// much larger than the thumbnail it holds. 'size' is what the buffer
+// really holds, which is what the pool counts and passes on as scratch.
+//
+
+unsigned char *				// O - At least 'bytes' long
+ThumbPool::buffer(size_t bytes,		// I - Bytes needed
+                  size_t &size)		// O - Bytes in the buffer
+{
+  int best = -1;
+
+  for (int i = 0; i < (int)scratch_.size(); i ++)
+    if (scratch_[i].bytes >= bytes && scratch_[i].bytes <= bytes + bytes / 4 &&
+        (best < 0 || scratch_[i].bytes < scratch_[best].bytes))
+      best = i;
+
+  if (best < 0)
+  {
+    size = bytes;
+    return new unsigned char[bytes];
+  }
+
+  unsigned char *pixels = scratch_[best].pixels;
+  size = scratch_[best].bytes;
+  scratch_.erase(scratch_.begin() + best);
+
+  return pixels;
+}
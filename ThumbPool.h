@@ -0,0 +1,65 @@
+#ifndef _THUMBPOOL_H_
+#define _THUMBPOOL_H_
+
+#include <FL/Fl_Image.H>
+#include <unordered_map>
+#include <vector>
+
+#include "PackedImage.h"
+
+// Unpacked copies of the PackedImage thumbnails being drawn, keyed by item
+// id. Sized for what is on screen: once the pool exceeds its byte limit
+// the least recently used copies are let go, and their pixel buffers kept
+// as scratch for the next unpack rather than freed.
+//
+// An image from get() stays valid until the next get(), or for as long
+// as keep(true) is in force [the pool may then go over its limit].
+//
+class ThumbPool
+{
+  struct ENTRY
+  {
+    const PackedImage *packed;  // unpacked from; a new one misses
+    Fl_RGB_Image      *image;
+    unsigned char     *pixels;
+    size_t            bytes;    // size of 'pixels', perhaps more than used
+    unsigned long     used;     // use counter when last got, for LRU
+  };
+
+  struct SCRATCH
+  {
+    unsigned char *pixels;
+    size_t        bytes;
+  };
+
+  std::unordered_map<unsigned, ENTRY> images_;
+  std::vector<SCRATCH> scratch_;    // buffers of let go copies
+  size_t        bytes_;             // unpacked pixels held
+  size_t        maxBytes_;
+  int           keep_;              // keep() nesting
+  unsigned long counter_;
+  unsigned long hits_;
+  unsigned long misses_;
+
+  void           evict(size_t room);
+  void           drop(ENTRY &e);
+  unsigned char *buffer(size_t bytes, size_t &size);
+
+public:
+  ThumbPool(size_t maxBytes = 48 * 1024 * 1024);
+  ~ThumbPool();
+
+  Fl_Image *get(unsigned id, const PackedImage *packed);
+  void      remove(unsigned id);
+  void      clear();
+  void      keep(bool val);
+
+  size_t        bytes() const { return bytes_; }
+  size_t        maxBytes() const { return maxBytes_; }
+  void          maxBytes(size_t val) { maxBytes_ = val; evict(0); }
+  size_t        count() const { return images_.size(); }
+  unsigned long hits() const { return hits_; }
+  unsigned long misses() const { return misses_; }
+};
+
+#endif // _THUMBPOOL_H_
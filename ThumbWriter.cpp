@@ -0,0 +1,145 @@
+//
+// Write-behind queue for thumbnail cache files.
+//
+// Contents:
+//
+//   ThumbWriter::buffer() - Get a buffer to encode a thumbnail into.
+//   ThumbWriter::write()  - Queue a thumbnail file.
+//   ThumbWriter::flush()  - Wait for queued thumbnails to be written.
+//   ThumbWriter::run()    - Write queued thumbnails.
+//
+
+#include "ThumbWriter.h"
+#include "ItemList.h"
+
+
+ThumbWriter::ThumbWriter(size_t maxQueued)
+{
+  queued_    = 0;
+  maxQueued_ = maxQueued;
+  busy_      = false;
+  stop_      = false;
+
+  thread_ = std::thread(&ThumbWriter::run, this);
+}
+
+ThumbWriter::~ThumbWriter()
+{
+  flush();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+
+  wake_.notify_one();
+  thread_.join();
+}
+
+
+//
+// 'ThumbWriter::buffer()' - Get a buffer to encode a thumbnail into.
+//
+
+std::vector<unsigned char>		// O - Empty buffer
+ThumbWriter::buffer()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<unsigned char>  data;
+
+  if (!spare_.empty())
+  {
+    data.swap(spare_.back());
+    spare_.pop_back();
+    data.clear();
+  }
+
+  return data;
+}
+
+
+//
+// 'ThumbWriter::write()' - Queue a thumbnail file.
+//
+
+void
+ThumbWriter::write(
+    const char                 *thumbname,	// I - Thumbnail filename
+    std::vector<unsigned char> &&data,		// I - File contents
+    bool                       claimed)		// I - Release the claim when written
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // Bound the memory held by a slow file system
+  done_.wait(lock, [this] { return queued_ < maxQueued_; });
+
+  queued_ += data.size();
+  queue_.push_back(JOB());
+  queue_.back().thumbname = thumbname;
+  queue_.back().data.swap(data);
+  queue_.back().claimed   = claimed;
+
+  lock.unlock();
+  wake_.notify_one();
+}
+
+
+//
+// 'ThumbWriter::flush()' - Wait for queued thumbnails to be written.
+//
+
+void
+ThumbWriter::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  done_.wait(lock, [this] { return queue_.empty() && !busy_; });
+}
+
+
+//
+// 'ThumbWriter::run()' - Write queued thumbnails.
+//
+// Takes everything queued at once, so a burst of thumbnails costs one
+// wakeup.
+//
+
+void
+ThumbWriter::run()
+{
+  std::vector<JOB> batch;
+
+
+  for (;;)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Return the last batch's buffers for reuse
+    for (JOB &job : batch)
+    {
+      queued_ -= job.data.size();
+      if (spare_.size() < 8)
+        spare_.push_back(std::move(job.data));
+    }
+    batch.clear();
+    busy_ = false;
+    done_.notify_all();
+
+    wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+
+    if (queue_.empty()) // stopping
+      return;
+
+    batch.swap(queue_);
+    busy_ = true;
+    lock.unlock();
+
+    for (JOB &job : batch)
+    {
+      ItemList::store_thumbnail(job.thumbname.c_str(), job.data.data(),
+                                job.data.size());
+      if (job.claimed)
+        ItemList::release_thumbnail(job.thumbname.c_str());
+    }
+  }
+}
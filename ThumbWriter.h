@@ -0,0 +1,55 @@
+#ifndef _THUMBWRITER_H_
+#define _THUMBWRITER_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Write-behind for the thumbnail cache. Thumbnails are encoded by the
+// caller into a buffer and written by a dedicated thread, so making them
+// isn't held up by the file system [e.g. a network home directory].
+// Buffers are recycled, and each file is written under a temporary name
+// and renamed into place.
+//
+// A thumbnail which is still queued isn't on disk yet; flush() waits for
+// the queue to drain, and the destructor flushes.
+//
+class ThumbWriter
+{
+  struct JOB
+  {
+    std::string                thumbname;
+    std::vector<unsigned char> data;
+    bool                       claimed;   // release the claim once written
+  };
+
+  std::thread                 thread_;
+  std::mutex                  mutex_;
+  std::condition_variable     wake_;       // work queued, or stopping
+  std::condition_variable     done_;       // queue drained, or room made
+  std::vector<JOB>            queue_;
+  std::vector<std::vector<unsigned char> > spare_; // buffers to reuse
+  size_t                      queued_;     // bytes waiting
+  size_t                      maxQueued_;
+  bool                        busy_;       // writer holds a batch
+  bool                        stop_;
+
+  void run();
+
+public:
+  ThumbWriter(size_t maxQueued = 64 * 1024 * 1024);
+  ~ThumbWriter();
+
+  // An empty buffer, possibly with capacity left from an earlier write
+  std::vector<unsigned char> buffer();
+
+  // Queue the encoded thumbnail; waits if too much is queued already.
+  // 'claimed' hands over the caller's ItemList::claim_thumbnail().
+  void write(const char *thumbname, std::vector<unsigned char> &&data,
+             bool claimed = false);
+  void flush();
+};
+
+#endif // _THUMBWRITER_H_
@@ -0,0 +1,213 @@
+//
+// Server-side pixmap cache for thumbnail tiles.
+//
+// Contents:
+//
+//   TileCache::find()   - Find a cached tile.
+//   TileCache::draw()   - Draw a tile, from the cache or by rendering it.
+//   TileCache::remove() - Drop the tiles for an item.
+//   TileCache::clear()  - Drop all tiles.
+//   TileCache::evict()  - Drop least recently drawn tiles over the limit.
+//
+
+#include "TileCache.h"
+
+
+TileCache::TileCache(size_t maxBytes)
+{
+  bytes_    = 0;
+  maxBytes_ = maxBytes;
+  counter_  = 0;
+}
+
+TileCache::~TileCache()
+{
+  clear();
+}
+
+
+//
+// 'TileCache::find()' - Find a cached tile.
+//
+
+TileCache::TILE *			// O - Tile or NULL
+TileCache::find(
+    unsigned   id,			// I - Item id
+    const void *image,			// I - Its thumbnailKey()
+    int        W,			// I - Tile width
+    int        H)			// I - Tile height
+{
+  auto it = tiles_.find(id);
+
+  if (it == tiles_.end())
+    return nullptr;
+
+  for (TILE &tile : it->second)
+    if (tile.image == image && tile.w == W && tile.h == H)
+      return &tile;
+
+  return nullptr;
+}
+
+
+//
+// 'TileCache::draw()' - Draw a cached tile.
+//
+
+bool					// O - false if not cached at this size
+TileCache::draw(
+    unsigned   id,			// I - Item id
+    const void *image,			// I - Its thumbnailKey()
+    int        W,			// I - Tile width
+    int        H,			// I - Tile height
+    int        X,			// I - Position to draw at
+    int        Y)
+{
+  TILE *tile = find(id, image, W, H);
+
+  if (!tile)
+    return false;
+
+  tile->used = ++counter_;
+  fl_copy_offscreen(X, Y, W, H, tile->pixmap, 0, 0);
+  return true;
+}
+
+
+//
+// 'TileCache::draw()' - Render a tile into the cache and draw it.
+//
+// The tile is the W x H area at (cx, cy) of the (already scaled) source,
+// as Fl_Image::draw() would draw it.
+//
+
+void
+TileCache::draw(
+    unsigned   id,			// I - Item id
+    const void *image,			// I - Its thumbnailKey()
+    Fl_Image   *src,			// I - Scaled image to render from
+    int        W,			// I - Tile width
+    int        H,			// I - Tile height
+    int        cx,			// I - Offset into src
+    int        cy,
+    int        X,			// I - Position to draw at
+    int        Y)
+{
+  Fl_Offscreen pixmap = W > 0 && H > 0 ? fl_create_offscreen(W, H) : 0;
+
+  if (!pixmap)
+  {
+    // No pixmap to be had: draw directly
+    src->draw(X, Y, W, H, cx, cy);
+    return;
+  }
+
+  fl_begin_offscreen(pixmap);
+  src->draw(0, 0, W, H, cx, cy);
+  fl_end_offscreen();
+
+  TILE *tile = find(id, image, W, H);
+
+  if (tile) // replaced
+  {
+    fl_delete_offscreen(tile->pixmap);
+    bytes_ -= (size_t)W * H * 4;
+  }
+  else
+  {
+    tiles_[id].push_back({ image, W, H, 0, 0 });
+    tile = &tiles_[id].back();
+  }
+
+  tile->pixmap = pixmap;
+  tile->used   = ++counter_;
+  bytes_ += (size_t)W * H * 4;
+
+  fl_copy_offscreen(X, Y, W, H, pixmap, 0, 0);
+
+  evict();
+}
+
+
+//
+// 'TileCache::remove()' - Drop the tiles for an item.
+//
+
+void
+TileCache::remove(unsigned id)		// I - Item id
+{
+
+  auto it = tiles_.find(id);
+
+  if (it == tiles_.end())
+    return;
+
+  for (TILE &tile : it->second)
+  {
+    fl_delete_offscreen(tile.pixmap);
+    bytes_ -= (size_t)tile.w * tile.h * 4;
+  }
+
+  tiles_.erase(it);
+}
+
+
+//
+// 'TileCache::clear()' - Drop all tiles.
+//
+
+void
+TileCache::clear()
+{
+
+  for (auto &it : tiles_)
+    for (TILE &tile : it.second)
+      fl_delete_offscreen(tile.pixmap);
+
+  tiles_.clear();
+  bytes_ = 0;
+}
+
+
+//
+// 'TileCache::evict()' - Drop least recently drawn tiles over the limit.
+//
+// The cache holds a few screenfuls of tiles, so a linear scan for the
+// oldest is cheap enough.
+//
+
+void
+TileCache::evict()
+{
+
+  while (bytes_ > maxBytes_)
+  {
+    auto   owner  = tiles_.end();	// Item with the oldest tile
+    size_t oldest = 0,			// Its index there
+           count  = 0;			// Tiles in all
+
+    for (auto it = tiles_.begin(); it != tiles_.end(); ++it)
+    {
+      count += it->second.size();
+
+      for (size_t t = 0; t < it->second.size(); t ++)
+        if (owner == tiles_.end() || it->second[t].used < owner->second[oldest].used)
+        {
+          owner  = it;
+          oldest = t;
+        }
+    }
+
+    if (count < 2)
+      break;
+
+    TILE &tile = owner->second[oldest];
+
+    fl_delete_offscreen(tile.pixmap);
+    bytes_ -= (size_t)tile.w * tile.h * 4;
+    owner->second.erase(owner->second.begin() + oldest);
+
+    if (owner->second.empty())
+      tiles_.erase(owner);
+  }
+}
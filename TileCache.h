@@ -0,0 +1,56 @@
+#ifndef _TILECACHE_H_
+#define _TILECACHE_H_
+
+#include <FL/Fl_Image.H>
+#include <FL/fl_draw.H>
+#include <unordered_map>
+#include <vector>
+
+// Server-side copies of scaled thumbnails, so redrawing a tile which was
+// drawn before is a pixmap copy rather than sending the pixels to the
+// display again. Tiles are found by item id, then matched on
+// ImageModel::thumbnailKey() and drawn size, so a hit needs no unpacked
+// thumbnail; a new tile size just misses. As a new thumbnail can be
+// packed at the address of the one it replaces, the widget remove()s an
+// item's tiles when it fetches a new one. The least recently drawn tiles
+// are released once the cache exceeds its byte limit.
+//
+// Must be used while drawing, since pixmaps are made with the current
+// window's graphics context.
+//
+class TileCache
+{
+  struct TILE
+  {
+    const void    *image;   // thumbnailKey()
+    int           w, h;
+    Fl_Offscreen  pixmap;
+    unsigned long used;     // draw counter when last drawn, for LRU
+  };
+
+  // Each item's tiles, one per size drawn at [usually one or two]
+  std::unordered_map<unsigned, std::vector<TILE> > tiles_;
+  size_t        bytes_;     // approximate server memory in use
+  size_t        maxBytes_;
+  unsigned long counter_;
+
+  TILE *find(unsigned id, const void *image, int W, int H);
+  void evict();
+
+public:
+  TileCache(size_t maxBytes = 64 * 1024 * 1024);
+  ~TileCache();
+
+  bool draw(unsigned id, const void *image, int W, int H, int X, int Y);
+  void draw(unsigned id, const void *image, Fl_Image *src,
+            int W, int H, int cx, int cy, int X, int Y);
+
+  void remove(unsigned id);
+  void clear();
+
+  size_t bytes() const { return bytes_; }
+  size_t maxBytes() const { return maxBytes_; }
+  void   maxBytes(size_t val) { maxBytes_ = val; evict(); }
+};
+
+#endif // _TILECACHE_H_
@@ -0,0 +1,254 @@
+//
+// Headless thumbnail cache pre-warmer for ThumbsVert.
+//
+// Walks one or more directory trees and creates or refreshes the cached
+// thumbnails which Fl_Image_BrowserV::load() would otherwise create on
+// first view. No window is created and no display connection is needed.
+//
+// Usage: ThumbsWarm [-j threads] [-c caches] [-f] [-q] directory [directory ...]
+//
+//   -j N   number of worker threads (default: all cores)
+//   -c C   "xvpics" (default), "freedesktop", or both comma separated,
+//          the cache to write first [see ItemList::thumb_caches()]
+//   -f     regenerate thumbnails even if the cached copy is current
+//   -q     only print the summary
+//
+// Several ThumbsWarm processes [and browsers] can work on the same tree:
+// each thumbnail is claimed by whoever makes it (see
+// ItemList::claim_thumbnail()). Images claimed by someone else are set
+// aside, and once everything else is done we wait for their thumbnails,
+// taking over any claim which goes stale.
+//
+
+#include <FL/Fl_Shared_Image.H>
+#include <FL/filename.H>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "ItemList.h"
+
+
+//
+// 'walk()' - Collect the image files in a directory tree.
+//
+
+static void
+walk(const char               *dirname,	// I - Directory to scan
+     std::vector<std::string> &found)	// O - Image files
+{
+  dirent	**files;		// Files in directory
+  char		absdir[1024],		// Absolute directory path
+		filename[2048];		// Absolute filename path
+
+
+  fl_filename_absolute(absdir, sizeof(absdir), dirname);
+
+  int num_files = fl_filename_list(absdir, &files);
+  if (num_files < 0)
+  {
+    fprintf(stderr, "ThumbsWarm: unable to read %s\n", absdir);
+    return;
+  }
+
+  for (int i = 0; i < num_files; i ++)
+  {
+    const char *name = files[i]->d_name;
+
+    // Skip ., .., our own cache directories and other hidden entries
+    if (name[0] != '.')
+    {
+      snprintf(filename, sizeof(filename), "%s/%s", absdir, name);
+
+      // fl_filename_list() marks directories with a trailing slash
+      size_t len = strlen(filename);
+      if (len > 1 && filename[len - 1] == '/')
+        filename[len - 1] = '\0';
+
+      // lstat() rather than fl_filename_isdir(), which follows links, so
+      // a symlinked directory cycle can't recurse forever. Linked
+      // directories are skipped; their names keep the trailing slash and
+      // don't match an image pattern either.
+      struct stat fileinfo;
+
+      if (!lstat(filename, &fileinfo) && S_ISDIR(fileinfo.st_mode))
+        walk(filename, found);
+      else if (fl_filename_match(name, ItemList::IMAGE_PATTERN))
+        found.push_back(filename);
+    }
+
+    free(files[i]);
+  }
+
+  free(files);
+}
+
+
+//
+// 'warm()' - Make the thumbnail for one image if it needs it.
+//
+
+enum { MADE, CURRENT, FAILED, BUSY };
+
+static int				// O - MADE, CURRENT, FAILED or BUSY
+warm(const char *filename,		// I - Image file
+     bool       force,			// I - Make it even if current
+     bool       wait,			// I - Wait out other processes' claims
+     double     &bytes)			// IO - Source bytes decoded
+{
+  char thumbname[2048];
+
+  if (!ItemList::thumb_path(filename, thumbname, sizeof(thumbname)))
+    return FAILED;
+
+  for (;;)
+  {
+    if (!force && ItemList::thumb_valid(filename, thumbname))
+      return CURRENT;
+
+    if (ItemList::claim_thumbnail(thumbname))
+      break;
+
+    if (!wait)
+      return BUSY;
+
+    usleep(100000);
+
+    // Whoever held the claim has made it
+    force = false;
+  }
+
+  struct stat fileinfo;
+  Fl_Image *image = stat(filename, &fileinfo) ? nullptr : ItemList::decode_image(filename, true);
+  Fl_Image *thumb = image ? ItemList::scale_thumbnail(image) : nullptr;
+  bool made = thumb && ItemList::write_thumbnail(filename, thumbname, thumb);
+
+  ItemList::release_thumbnail(thumbname);
+
+  delete thumb;
+  delete image;
+
+  if (!made)
+    return FAILED;
+
+  bytes += fileinfo.st_size;
+  return MADE;
+}
+
+
+//
+// 'usage()' - Show program usage.
+//
+
+static int
+usage()
+{
+  fputs("Usage: ThumbsWarm [-j threads] [-c caches] [-f] [-q] directory [directory ...]\n",
+        stderr);
+  return 1;
+}
+
+
+int main(int argc, char** argv) {
+
+    int threads = omp_get_num_procs();
+    bool force = false;
+    bool quiet = false;
+    std::vector<std::string> files;
+
+    // Only used for formats without a direct decoder. Doesn't open a display.
+    fl_register_images();
+
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            if (!ItemList::thumb_caches(argv[++i]))
+                return usage();
+        }
+        else if (!strcmp(argv[i], "-f"))
+            force = true;
+        else if (!strcmp(argv[i], "-q"))
+            quiet = true;
+        else
+            return usage();
+    }
+
+    if (i >= argc || threads < 1)
+        return usage();
+
+    for (; i < argc; i++)
+        walk(argv[i], files);
+
+    int numFiles = (int)files.size();
+    int made = 0, skipped = 0, failed = 0;
+    double bytes = 0.0; // source image bytes decoded
+    std::vector<int> busy; // claimed by another process
+
+    if (!quiet)
+        printf("ThumbsWarm: %d images, %d threads\n", numFiles, threads);
+
+    double start = omp_get_wtime();
+
+    // Dynamic schedule: decode time varies a lot between images. The
+    // second pass waits for the images other processes had claimed.
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::vector<int> todo;
+
+        if (pass)
+            todo.swap(busy);
+        else
+            for (int j = 0; j < numFiles; j++)
+                todo.push_back(j);
+
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 4) \
+        reduction(+:made, skipped, failed, bytes)
+        for (int k = 0; k < (int)todo.size(); k++)
+        {
+            const char *filename = files[todo[k]].c_str();
+
+            switch (warm(filename, force, pass > 0, bytes))
+            {
+            case MADE :
+                made++;
+                break;
+            case CURRENT :
+                skipped++;
+                break;
+            case FAILED :
+                failed++;
+                if (!quiet)
+                    fprintf(stderr, "ThumbsWarm: unable to thumbnail %s\n", filename);
+                break;
+            case BUSY :
+#pragma omp critical
+                busy.push_back(todo[k]);
+                break;
+            }
+        }
+
+        if (!quiet && !pass && !busy.empty())
+            printf("ThumbsWarm: waiting for %d images claimed elsewhere\n",
+                   (int)busy.size());
+    }
+
+    double elapsed = omp_get_wtime() - start;
+    if (elapsed <= 0.0)
+        elapsed = 1e-6;
+
+    printf("ThumbsWarm: %d created, %d current, %d failed in %.2fs "
+           "(%.1f images/s, %.1f MB/s)\n",
+           made, skipped, failed, elapsed,
+           made / elapsed, bytes / (1024.0 * 1024.0) / elapsed);
+
+    return failed ? 2 : 0;
+}
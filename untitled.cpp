@@ -1,6 +1,8 @@
 #include <FL/Fl_Native_File_Chooser.H>
+#include <FL/Fl_Input.H>
 
 #include "Fl_Image_Browser.H"
+#include "FilteredModel.h"
 
 char *fl_native_file_chooser(const char *message,const char *pat,const char *fname,int relative=0) {
 
@@ -46,6 +48,7 @@ void dobtn(Fl_Widget *, void *)
 #endif
 
 Fl_Image_BrowserV *browser_;
+FilteredModel *filter_;
 
 void cb_browser_(Fl_Image_BrowserV* o, void* v) 
 {
@@ -66,9 +69,37 @@ void cb_stack(Fl_Widget *o, void *d)
     browser_->setStackMode(w->value() == 1);
 }
 
+void cb_filter(Fl_Widget *o, void *d)
+{
+    Fl_Input *w = dynamic_cast<Fl_Input *>(o);
+    if (!filter_->filter(w->value()))
+        return;
+
+    // Back to the full list when the filter is cleared
+    ImageModel *shown = *w->value() ? filter_ : nullptr;
+    if (shown && browser_->model() == shown)
+        browser_->modelChanged();
+    else
+        browser_->model(shown);
+}
+
 int main(int argc, char** argv) {
 
     fl_register_images();
+
+    // Thumbnails and full images are decoded on worker threads, which
+    // hand them over with Fl::awake()
+    Fl::lock();
+
+    // "xvpics", "freedesktop" or both, see ItemList::thumb_caches()
+    const char *caches = getenv("THUMBSVERT_CACHE");
+    if (caches && !ItemList::thumb_caches(caches))
+        fprintf(stderr, "ThumbsVert: unknown THUMBSVERT_CACHE \"%s\"\n", caches);
+
+    // "0" keeps thumbnails exact, see ItemList::pack_thumbnails()
+    const char *pack = getenv("THUMBSVERT_PACK");
+    if (pack && !strcmp(pack, "0"))
+        ItemList::pack_thumbnails(false);
     
     Fl_Double_Window window(50, 50, 500, 750);
     
@@ -83,6 +114,10 @@ int main(int argc, char** argv) {
     
     Fl_Check_Button *stack = new Fl_Check_Button(210, 10, 100, 25, "Stack");
     stack->callback(cb_stack);
+
+    Fl_Input *filter = new Fl_Input(340, 10, 150, 25, "Filter:");
+    filter->callback(cb_filter);
+    filter->when(FL_WHEN_CHANGED);
     
     browser_ = new Fl_Image_BrowserV(10, 40, 400, 600);
     browser_->box(FL_DOWN_BOX);
@@ -99,6 +134,8 @@ int main(int argc, char** argv) {
     
     browser_->end();
 
+    filter_ = new FilteredModel(browser_->model());
+
 	// TODO use chooser to open folder
     browser_->load("/mnt/brix1/temp/testImages");
     